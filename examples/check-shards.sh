@@ -0,0 +1,28 @@
+#!/bin/sh
+# Runs the rules over the data with a single context and with shards, and compares the
+# output. Shards print at the same time, so lines are compared sorted. Data goes by a pipe,
+# as stdin can not be a regular file.
+#
+#   examples/check-shards.sh loglang rules data [shards]
+#
+# For example with loglang-gen --frames 100 > /tmp/data and examples/monitor-rules.log.
+
+set -e
+if [ $# -lt 3 ]; then
+	echo "usage: $0 loglang rules data [shards]" >&2
+	exit 2
+fi
+LOGLANG=$1
+RULES=$2
+DATA=$3
+SHARDS=${4:-4}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat "$DATA" | "$LOGLANG" "$RULES" 2>/dev/null | sort > "$TMP/single"
+cat "$DATA" | "$LOGLANG" --shards "$SHARDS" "$RULES" 2>/dev/null | sort > "$TMP/sharded"
+if ! diff "$TMP/single" "$TMP/sharded"; then
+	echo "Output with $SHARDS shards differs" >&2
+	exit 1
+fi
+echo "Same output with $SHARDS shards, $(wc -l < "$TMP/single") lines"
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+#include "aggregate.hpp"
+#include "symbol.hpp"
+
+using namespace loglang;
+
+/// Double updates before the double sum is recalculated from the members.
+static const size_t max_double_updates=4096;
+
+void GlobAggregate::add(const any &val)
+{
+	if (!val)
+		return;
+	count++;
+	switch(val.type()){
+		case any::INT:{
+			int64_t sum;
+			if (__builtin_add_overflow(int_sum, val.to_int(), &sum)){ // As 64 bit counters, goes to the double sum
+				double_sum+=double(int_sum)+double(val.to_int());
+				double_updates++;
+				sum=0;
+			}
+			int_sum=sum;
+		}
+		break;
+		case any::DOUBLE:{
+			auto d=val.to_double();
+			if (std::isnan(d)){
+				nans++;
+				return;
+			}
+			if (std::isinf(d))
+				(d>0 ? pos_inf : neg_inf)++;
+			else{
+				double_sum+=d;
+				double_updates++;
+			}
+		}
+		break;
+		default:
+			non_numeric++;
+			return;
+	}
+	if (sorted)
+		values.insert(val.to_double());
+}
+
+void GlobAggregate::remove(const any &val)
+{
+	if (!val)
+		return;
+	count--;
+	switch(val.type()){
+		case any::INT:{
+			int64_t sum;
+			if (__builtin_sub_overflow(int_sum, val.to_int(), &sum)){
+				double_sum+=double(int_sum)-double(val.to_int());
+				double_updates++;
+				sum=0;
+			}
+			int_sum=sum;
+		}
+		break;
+		case any::DOUBLE:{
+			auto d=val.to_double();
+			if (std::isnan(d)){
+				nans--;
+				return;
+			}
+			if (std::isinf(d))
+				(d>0 ? pos_inf : neg_inf)--;
+			else{
+				double_sum-=d;
+				double_updates++;
+			}
+		}
+		break;
+		default:
+			non_numeric--;
+			return;
+	}
+	if (sorted)
+		values.erase(values.find(val.to_double()));
+}
+
+void GlobAggregate::recalculate()
+{
+	count=non_numeric=0;
+	nans=pos_inf=neg_inf=0;
+	int_sum=0;
+	double_sum=0.0;
+	values.clear();
+	for(auto sym: members)
+		add(sym->get());
+	double_updates=0;
+}
+
+/// Sum of the members, as adding them all: NaN if any is NaN, or there are infinites of both signs.
+double GlobAggregate::total() const
+{
+	if (nans>0 || (pos_inf>0 && neg_inf>0))
+		return std::numeric_limits<double>::quiet_NaN();
+	if (pos_inf>0)
+		return std::numeric_limits<double>::infinity();
+	if (neg_inf>0)
+		return -std::numeric_limits<double>::infinity();
+	return double(int_sum) + double_sum;
+}
+
+void GlobAggregate::add_member(Symbol *sym)
+{
+	members.push_back(sym);
+	add(sym->get());
+}
+
+void GlobAggregate::update(const any &prev, const any &next)
+{
+	remove(prev);
+	add(next);
+}
+
+void GlobAggregate::keep_sorted()
+{
+	if (sorted)
+		return;
+	sorted=true;
+	recalculate();
+}
+
+any GlobAggregate::get(kind_t kind)
+{
+	if (kind==COUNT)
+		return to_any( int64_t(count) );
+	if (non_numeric>0)
+		throw std::runtime_error(std::string("Non numeric values at ")+kind_name(kind)+"("+glob.str()+")");
+	if (double_updates>max_double_updates || !std::isfinite(double_sum)) // Finite members may overflow it
+		recalculate();
+	switch(kind){
+		case SUM:
+			return to_any( total() );
+		case AVG:
+			if (count==0)
+				throw std::runtime_error("avg("+glob.str()+") of no values");
+			return to_any( total() / count );
+		case MIN:
+		case MAX:
+			if (!sorted)
+				throw std::runtime_error(std::string(kind_name(kind))+"("+glob.str()+") is not kept sorted");
+			if (values.empty() && nans>0)
+				return to_any( std::numeric_limits<double>::quiet_NaN() );
+			if (values.empty())
+				throw std::runtime_error(std::string(kind_name(kind))+"("+glob.str()+") of no values");
+			return to_any( kind==MIN ? *values.begin() : *values.rbegin() );
+		default:
+			throw std::runtime_error("Unknown aggregate");
+	}
+}
+
+static const char *kind_names[]={ "sum", "count", "min", "max", "avg" };
+
+bool GlobAggregate::kind_from_name(const std::string &fname, kind_t &kind)
+{
+	for(uint16_t k=SUM; k<=AVG; k++){
+		if (fname==kind_names[k]){
+			kind=kind_t(k);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *GlobAggregate::kind_name(kind_t kind)
+{
+	return kind_names[kind];
+}
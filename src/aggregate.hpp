@@ -0,0 +1,82 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <cstdint>
+
+#include "value.hpp"
+#include "glob.hpp"
+
+namespace loglang{
+	class Symbol;
+
+	/**
+	 * @short Running sum, count, min, max and avg of the symbols that match a glob
+	 *
+	 * Member symbols notify every change with the previous and new value, so the totals are updated
+	 * by the difference and reading them is O(1). New symbols that match the glob are added by the
+	 * Context as they are created.
+	 *
+	 * Ints are added exactly; double totals are recalculated from the members from time to time, so
+	 * rounding errors do not accumulate. Infinite and NaN members are counted apart, so they do
+	 * not stay in the total once they change. Min and max need the sorted values, so they are only
+	 * kept after some program asks for them; NaN is left out, as it does not compare.
+	 */
+	class GlobAggregate{
+	public:
+		enum kind_t : uint16_t{
+			SUM=0,
+			COUNT,
+			MIN,
+			MAX,
+			AVG
+		};
+	private:
+		Glob glob;
+		std::vector<Symbol*> members;
+		size_t count=0; // Defined members
+		size_t non_numeric=0;
+		int64_t int_sum=0; // If it would overflow, it is moved to double_sum
+		double double_sum=0.0;
+		size_t double_updates=0; // Since last recalculation
+		size_t nans=0, pos_inf=0, neg_inf=0;
+		bool sorted=false;
+		std::multiset<double> values; // If sorted
+
+		void add(const any &val);
+		void remove(const any &val);
+		void recalculate();
+		double total() const;
+	public:
+		GlobAggregate(Glob glob) : glob(std::move(glob)) {}
+
+		const Glob &get_glob() const { return glob; }
+		void add_member(Symbol *sym);
+		void update(const any &prev, const any &next);
+		/// Starts to keep the sorted values, needed for min and max.
+		void keep_sorted();
+
+		any get(kind_t kind);
+
+		/// Aggregate for that builtin function name, if any.
+		static bool kind_from_name(const std::string &fname, kind_t &kind);
+		static const char *kind_name(kind_t kind);
+	};
+}
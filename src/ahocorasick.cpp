@@ -0,0 +1,93 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <deque>
+#include <map>
+
+#include "ahocorasick.hpp"
+
+using namespace loglang;
+
+uint32_t AhoCorasick::add(std::string pattern)
+{
+	for(unsigned char c: pattern){
+		if (byte_class[c]==0)
+			byte_class[c]=nclasses++;
+	}
+	patterns.push_back(std::move(pattern));
+	delta.clear();
+	return patterns.size()-1;
+}
+
+void AhoCorasick::clear()
+{
+	byte_class.fill(0);
+	nclasses=1;
+	delta.clear();
+	outputs.clear();
+	patterns.clear();
+}
+
+/**
+ * First a trie of the patterns, then the missing transitions are filled breadth first from the
+ * node of the longest proper suffix, which is already complete as it is shallower.
+ */
+void AhoCorasick::build()
+{
+	std::vector<std::map<uint8_t, uint32_t>> trie(1);
+	outputs.assign(1, {});
+	for(uint32_t id=0;id<patterns.size();id++){
+		uint32_t node=0;
+		for(unsigned char c: patterns[id]){
+			auto cls=byte_class[c];
+			auto I=trie[node].find(cls);
+			if (I==std::end(trie[node])){
+				trie[node][cls]=trie.size();
+				node=trie.size();
+				trie.emplace_back();
+				outputs.emplace_back();
+			}
+			else
+				node=I->second;
+		}
+		outputs[node].push_back(id);
+	}
+
+	delta.assign(trie.size()*nclasses, 0);
+	std::vector<uint32_t> fail(trie.size(), 0);
+	std::deque<uint32_t> queue;
+	for(auto &child: trie[0]){
+		delta[child.first]=child.second;
+		queue.push_back(child.second);
+	}
+	while (!queue.empty()){
+		auto node=queue.front();
+		queue.pop_front();
+		auto &out=outputs[node];
+		out.insert(std::end(out), std::begin(outputs[fail[node]]), std::end(outputs[fail[node]]));
+		for(size_t cls=0;cls<nclasses;cls++){
+			auto I=trie[node].find(cls);
+			if (I==std::end(trie[node])){
+				delta[node*nclasses+cls]=delta[fail[node]*nclasses+cls];
+				continue;
+			}
+			auto child=I->second;
+			fail[child]=delta[fail[node]*nclasses+cls];
+			delta[node*nclasses+cls]=child;
+			queue.push_back(child);
+		}
+	}
+}
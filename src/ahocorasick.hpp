@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+namespace loglang{
+	/**
+	 * @short Finds many literal strings at once in a single pass over the text.
+	 *
+	 * Aho-Corasick automaton built into a full DFA, so each text byte is a single table lookup.
+	 * Bytes that appear in no pattern share one column, so the table is as wide as the distinct
+	 * bytes in the patterns and not 256.
+	 */
+	class AhoCorasick{
+		std::array<uint8_t, 256> byte_class;
+		size_t nclasses=1; // 0 is for bytes in no pattern
+		std::vector<uint32_t> delta; // nodes x nclasses
+		std::vector<std::vector<uint32_t>> outputs; // Pattern ids that end at each node, also through suffixes
+		std::vector<std::string> patterns;
+	public:
+		AhoCorasick(){ byte_class.fill(0); }
+
+		/// Adds a pattern, returns its id. Needs a build() before scan().
+		uint32_t add(std::string pattern);
+		void build();
+		void clear();
+		bool empty() const { return patterns.empty(); }
+
+		/// Calls f(id) for each pattern occurrence in the text; the same id may be found many times.
+		template<typename F>
+		void scan(std::string_view text, F &&f) const{
+			if (delta.empty())
+				return;
+			uint32_t state=0;
+			for(unsigned char c: text){
+				state=delta[state*nclasses+byte_class[c]];
+				for(auto id: outputs[state])
+					f(id);
+			}
+		}
+	};
+}
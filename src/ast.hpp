@@ -18,17 +18,21 @@
 
 #include <string>
 #include <set>
+#include <cstdint>
 
 #include "value.hpp"
 
 namespace loglang{
 	class Context;
+	class Compiler;
 	class ASTBase{
 	public:
 		virtual ~ASTBase(){}
 		virtual any eval(Context &context) = 0;
 		virtual std::string to_string() = 0;
 		virtual std::set<std::string> dependencies() = 0;
+		/// Emits the bytecode for this node, and returns the register with the result.
+		virtual uint16_t compile(Compiler &c) = 0;
 	};
 	
 	using AST=std::unique_ptr<ASTBase>;
@@ -21,20 +21,33 @@
 
 #include "utils.hpp"
 #include "ast.hpp"
+#include "bytecode.hpp"
 #include "context.hpp"
+#include "aggregate.hpp"
+#include "number.hpp"
 
 namespace loglang{
 	namespace ast{
 		class Equal : public ASTBase{
 			std::string var;
+			Symbol *sym=nullptr; // Resolved at first use
 			AST op2;
 		public:
 			Equal(std::string var, AST op2) : var(var), op2(std::move(op2)){}
 			any eval(Context &context){
 				auto op2_res=op2->eval(context);
-				context.get_value(var).set(op2_res->clone(), context);
+				if (context.journal())
+					context.journal()->emplace_back(var, op2_res);
+				if (!sym)
+					sym=&context.get_value(var);
+				sym->set(op2_res, context);
 				return op2_res;
 			}
+			uint16_t compile(Compiler &c){
+				auto r=op2->compile(c);
+				c.emit(Instr::STORE, 0, c.symbol(var), r);
+				return r;
+			}
 			std::set< std::string > dependencies(){
 				return op2->dependencies();
 			}
@@ -50,10 +63,8 @@ namespace loglang{
 			Value_const(Token t){
 				switch(t.type){
 					case Token::NUMBER:
-						if (std::find(std::begin(t.token),std::end(t.token),'.')==std::end(t.token))
-							val=std::move(to_any(int64_t(to_number(t.token))));
-						else
-							val=std::move(to_any(to_number(t.token)));
+						if (!parse_number(t.token, val))
+							val=to_any(int64_t(0));
 					break;
 					case Token::STRING:
 						val=std::move(to_any(t.token));
@@ -63,7 +74,12 @@ namespace loglang{
 				}
 			}
 			any eval(Context &context){
-				return val->clone();
+				return val;
+			}
+			uint16_t compile(Compiler &c){
+				auto r=c.reg();
+				c.emit(Instr::CONST, r, c.constant(val));
+				return r;
 			}
 			
 			std::set< std::string > dependencies(){
@@ -77,12 +93,20 @@ namespace loglang{
 		class Value_var : public Value{
 		public:
 			std::string var;
+			Symbol *sym=nullptr; // Resolved at first use
 			Value_var(Token _val) : var(_val.token) {}
 			any eval(Context &context){
-				auto &v=context.get_value(var).get();
+				if (!sym)
+					sym=&context.get_value(var);
+				auto &v=sym->get();
 				if (!v)
 					throw std::runtime_error(std::string("Value <")+var+"> undefined. Cant use yet.");
-				return v->clone();
+				return v;
+			}
+			uint16_t compile(Compiler &c){
+				auto r=c.reg();
+				c.emit(Instr::LOAD, r, c.symbol(var));
+				return r;
 			}
 			std::set<std::string> dependencies(){
 				return { var };
@@ -94,9 +118,15 @@ namespace loglang{
 		class Value_glob : public Value{
 		public:
 			std::string var;
-			Value_glob(Token _val) : var(_val.token) {}
+			Glob glob;
+			Value_glob(Token _val) : var(_val.token), glob(var) {}
 			any eval(Context &context){
-				return context.get_glob_values( var );
+				return context.get_glob_values( glob );
+			}
+			uint16_t compile(Compiler &c){
+				auto r=c.reg();
+				c.emit(Instr::GLOB, r, c.glob(var));
+				return r;
 			}
 			std::set<std::string> dependencies(){
 				return { var };
@@ -105,6 +135,25 @@ namespace loglang{
 				return "<ValueGlob "+var+">";
 			};
 		};
+		class Value_capture : public Value{
+		public:
+			uint16_t n;
+			Value_capture(Token _val) : n(std::stoi(_val.token)) {}
+			any eval(Context &context){
+				return context.capture(n);
+			}
+			uint16_t compile(Compiler &c){
+				auto r=c.reg();
+				c.emit(Instr::CAPTURE, r, n);
+				return r;
+			}
+			std::set<std::string> dependencies(){
+				return {};
+			}
+			std::string to_string(){
+				return "<Value_capture $"+std::to_string(int(n))+">";
+			};
+		};
 		
 		class Expr : public ASTBase{
 		public:
@@ -120,6 +169,14 @@ namespace loglang{
 			std::string to_string_(const std::string &op){
 				return "<"+op+" "+op1->to_string()+" "+op2->to_string()+">";
 			};
+			uint16_t compile_(Compiler &c, Instr::op_t op){
+				auto r=c.mark();
+				auto a=op1->compile(c);
+				auto b=op2->compile(c);
+				c.release(r);
+				c.emit(op, c.reg(), a, b);
+				return r;
+			}
 		};
 		
 		class Expr_mul : public Expr{
@@ -128,14 +185,17 @@ namespace loglang{
 			any eval(Context &context){
 				auto r1=op1->eval(context);
 				auto r2=op2->eval(context);
-				if (r1->type_name==r2->type_name && r1->type_name=="int")
-					return to_any( op1->eval(context)->to_int() * op2->eval(context)->to_int() );
+				if (r1.type()==any::INT && r2.type()==any::INT)
+					return to_any( r1.to_int() * r2.to_int() );
 				else
-					return to_any( op1->eval(context)->to_double() * op2->eval(context)->to_double() );
+					return to_any( r1.to_double() * r2.to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_mul");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::MUL);
+			}
 		};
 		class Expr_div : public Expr{
 		public:
@@ -143,71 +203,92 @@ namespace loglang{
 			any eval(Context &context){
 				auto r1=op1->eval(context);
 				auto r2=op2->eval(context);
-				return to_any( r1->to_double() / r2->to_double() );
+				return to_any( r1.to_double() / r2.to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_div");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::DIV);
+			}
 		};
 		class Expr_lt : public Expr{
 		public:
 			Expr_lt(AST op1, AST op2) : Expr(std::move(op1), std::move(op2)) {}
 			any eval(Context &context){
-				return to_any( op1->eval(context)->to_double() < op2->eval(context)->to_double() );
+				return to_any( op1->eval(context).to_double() < op2->eval(context).to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_lt");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::LT);
+			}
 		};
 		class Expr_lte : public Expr{
 		public:
 			Expr_lte(AST op1, AST op2) : Expr(std::move(op1), std::move(op2)) {}
 			any eval(Context &context){
-				return to_any( op1->eval(context)->to_double() <= op2->eval(context)->to_double() );
+				return to_any( op1->eval(context).to_double() <= op2->eval(context).to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_lte");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::LTE);
+			}
 		};
 		class Expr_gt : public Expr{
 		public:
 			Expr_gt(AST op1, AST op2) : Expr(std::move(op1), std::move(op2)) {}
 			any eval(Context &context){
-				return to_any( op1->eval(context)->to_double() > op2->eval(context)->to_double() );
+				return to_any( op1->eval(context).to_double() > op2->eval(context).to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_gt");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::GT);
+			}
 		};
 		class Expr_gte : public Expr{
 		public:
 			Expr_gte(AST op1, AST op2) : Expr(std::move(op1), std::move(op2)) {}
 			any eval(Context &context){
-				return to_any( op1->eval(context)->to_double() >= op2->eval(context)->to_double() );
+				return to_any( op1->eval(context).to_double() >= op2->eval(context).to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_gte");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::GTE);
+			}
 		};
 		class Expr_eq : public Expr{
 		public:
 			Expr_eq(AST op1, AST op2) : Expr(std::move(op1), std::move(op2)) {}
 			any eval(Context &context){
-				return to_any( op1->eval(context)->to_double() == op2->eval(context)->to_double() );
+				return to_any( op1->eval(context).to_double() == op2->eval(context).to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_eq");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::EQ);
+			}
 		};
 		class Expr_neq : public Expr{
 		public:
 			Expr_neq(AST op1, AST op2) : Expr(std::move(op1), std::move(op2)) {}
 			any eval(Context &context){
-				return to_any( op1->eval(context)->to_double() != op2->eval(context)->to_double() );
+				return to_any( op1->eval(context).to_double() != op2->eval(context).to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_neq");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::NEQ);
+			}
 		};
 		class Expr_add : public Expr{
 		public:
@@ -215,17 +296,20 @@ namespace loglang{
 			any eval(Context &context){
 				auto r1=op1->eval(context);
 				auto r2=op2->eval(context);
-				if (r1->type_name==r2->type_name){
-					if (r1->type_name=="string")
-						return to_any( r1->to_string() + r2->to_string() );
-					if (r1->type_name=="int")
-						return to_any( r1->to_int() + r2->to_int() );
+				if (r1.type()==r2.type()){
+					if (r1.type()==any::STRING)
+						return to_any( r1.to_string() + r2.to_string() );
+					if (r1.type()==any::INT)
+						return to_any( r1.to_int() + r2.to_int() );
 				}
-				return to_any( r1->to_double() + r2->to_double() );
+				return to_any( r1.to_double() + r2.to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_add");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::ADD);
+			}
 		};
 		class Expr_sub : public Expr{
 		public:
@@ -233,15 +317,16 @@ namespace loglang{
 			any eval(Context &context){
 				auto r1=op1->eval(context);
 				auto r2=op2->eval(context);
-				if (r1->type_name==r2->type_name){
-					if (r1->type_name=="int")
-						return to_any( r1->to_int() - r2->to_int() );
-				}
-				return to_any( r1->to_double() - r2->to_double() );
+				if (r1.type()==any::INT && r2.type()==any::INT)
+					return to_any( r1.to_int() - r2.to_int() );
+				return to_any( r1.to_double() - r2.to_double() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_sub");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::SUB);
+			}
 		};
 		class Expr_and : public Expr{
 		public:
@@ -249,11 +334,14 @@ namespace loglang{
 			any eval(Context &context){
 				auto r1=op1->eval(context);
 				auto r2=op2->eval(context);
-				return to_any( r1->to_bool() && r2->to_bool() );
+				return to_any( r1.to_bool() && r2.to_bool() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_and");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::AND);
+			}
 		};
 		class Expr_or : public Expr{
 		public:
@@ -261,11 +349,14 @@ namespace loglang{
 			any eval(Context &context){
 				auto r1=op1->eval(context);
 				auto r2=op2->eval(context);
-				return to_any( r1->to_bool() || r2->to_bool() );
+				return to_any( r1.to_bool() || r2.to_bool() );
 			}
 			std::string to_string(){
 				return to_string_("Expr_and");
 			}
+			uint16_t compile(Compiler &c){
+				return compile_(c, Instr::OR);
+			}
 		};
 		class Block : public ASTBase{
 		public:
@@ -287,6 +378,18 @@ namespace loglang{
 				
 				return ss.str(); 
 			}
+			uint16_t compile(Compiler &c){
+				auto r=c.mark();
+				if (stmts.empty()){
+					c.emit(Instr::NIL, c.reg());
+					return r;
+				}
+				for(auto &st:stmts){
+					c.release(r);
+					st->compile(c);
+				}
+				return r;
+			}
 			std::set< std::string > dependencies(){
 				std::set< std::string > res;
 				for(auto &st:stmts)
@@ -304,7 +407,7 @@ namespace loglang{
 			Edge_if(AST _cond, AST if_true, AST if_false) : Expr(std::move(if_true), std::move(if_false)) , cond(std::move(_cond)), prev_value(false) {
 			}
 			any eval(Context &context){
-				bool current=cond->eval(context)->to_bool();
+				bool current=cond->eval(context).to_bool();
 				if (current!=prev_value){
 					prev_value=current;
 					if (current)
@@ -320,6 +423,24 @@ namespace loglang{
 			std::string to_string(){
 				return "<Edge_if "+cond->to_string()+" "+op1->to_string()+""+op2->to_string()+">";
 			}
+			uint16_t compile(Compiler &c){
+				auto r=cond->compile(c);
+				auto unchanged=c.emit(Instr::EDGE, c.state(), 0, r);
+				auto if_false=c.emit(Instr::JF, 0, 0, r);
+				c.release(r);
+				op1->compile(c);
+				auto end1=c.emit(Instr::JMP);
+				c.patch(if_false);
+				c.release(r);
+				op2->compile(c);
+				auto end2=c.emit(Instr::JMP);
+				c.patch(unchanged);
+				c.release(r);
+				c.emit(Instr::CONST, c.reg(), c.constant(to_any(false)));
+				c.patch(end1);
+				c.patch(end2);
+				return r;
+			}
 		};
 		class At : public Expr{
 		public:
@@ -329,7 +450,7 @@ namespace loglang{
 			}
 			any eval(Context &context){
 				any current=op1->eval(context);
-				if (current!=prev_value){
+				if (!(current==prev_value)){
 					prev_value=std::move(current);
 					return op2->eval(context);
 				}
@@ -341,6 +462,18 @@ namespace loglang{
 			std::string to_string(){
 				return to_string_("At");
 			}
+			uint16_t compile(Compiler &c){
+				auto r=op1->compile(c);
+				auto unchanged=c.emit(Instr::AT, c.state(), 0, r);
+				c.release(r);
+				op2->compile(c);
+				auto end=c.emit(Instr::JMP);
+				c.patch(unchanged);
+				c.release(r);
+				c.emit(Instr::CONST, c.reg(), c.constant(to_any("")));
+				c.patch(end);
+				return r;
+			}
 		};
 		class Function : public ASTBase{
 		public:
@@ -374,6 +507,24 @@ namespace loglang{
 				
 				return "<Function "+fnname+" {"+params_str+"}>";
 			}
+			uint16_t compile(Compiler &c){
+				// sum, count... of a single glob read the incrementally kept aggregate
+				GlobAggregate::kind_t kind;
+				if (params.size()==1 && GlobAggregate::kind_from_name(fnname, kind)){
+					auto glob=dynamic_cast<Value_glob*>(params[0].get());
+					if (glob){
+						auto r=c.reg();
+						c.emit(Instr::AGG, r, c.aggregate(glob->var), kind);
+						return r;
+					}
+				}
+				auto r=c.mark();
+				for(auto &p: params)
+					p->compile(c); // Each at the next register, so they are consecutive.
+				c.release(r);
+				c.emit(Instr::CALL, c.reg(), c.function(fnname), params.size());
+				return r;
+			}
 		};
 	}
 };
\ No newline at end of file
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+
+#include "context.hpp"
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "glob.hpp"
+#include "linescan.hpp"
+#include "benchmode.hpp"
+
+namespace loglang{
+	extern bool units;
+}
+
+using namespace loglang;
+
+namespace{
+	/// Keeps the compiler from optimizing away the value.
+	template<typename T>
+	inline void keep(const T &value){
+		asm volatile("" : : "g"(&value) : "memory");
+	}
+
+	/**
+	 * @short Runs the benchmarks and collects the results.
+	 *
+	 * Each benchmark is a function that does n operations. The n is found doubling until a run
+	 * takes a tenth of the minimum time, and then it is repeated so each repetition takes about
+	 * min_time/repetitions. The median and the best time per operation are kept.
+	 */
+	class Bench{
+	public:
+		class Result{
+		public:
+			std::string name;
+			uint64_t iterations;
+			double ns_per_op;
+			double min_ns_per_op;
+		};
+		std::string filter;
+		std::chrono::milliseconds min_time{500};
+		int repetitions=5;
+		std::vector<Result> results;
+
+		void run(const std::string &name, std::function<void (uint64_t n)> f){
+			if (!filter.empty() && name.find(filter)==std::string::npos)
+				return;
+			using clock=std::chrono::steady_clock;
+			auto time=[&f](uint64_t n){
+				auto start=clock::now();
+				f(n);
+				return std::chrono::duration<double, std::nano>(clock::now()-start).count();
+			};
+			double target=std::chrono::duration<double, std::nano>(min_time).count();
+			uint64_t n=1;
+			double t;
+			while ((t=time(n))<target/10 && n<(uint64_t(1)<<40))
+				n*=2;
+			n=std::max<uint64_t>(1, uint64_t(n*(target/repetitions)/std::max(t, 1.0)));
+			std::vector<double> times;
+			for(int i=0;i<repetitions;i++)
+				times.push_back(time(n)/n);
+			std::sort(std::begin(times), std::end(times));
+			results.push_back(Result{name, n*repetitions, times[times.size()/2], times[0]});
+			std::cerr<<name<<": "<<times[times.size()/2]<<" ns/op"<<std::endl;
+		}
+
+		void write_json(std::ostream &out) const{
+			out<<"{\n";
+			out<<"  \"context\": {\"linescan\": \""<<LineScanner::implementation()<<"\", \"min_time_ms\": "<<min_time.count()<<", \"repetitions\": "<<repetitions<<"},\n";
+			out<<"  \"benchmarks\": [";
+			for(size_t i=0;i<results.size();i++){
+				auto &r=results[i];
+				out<<(i ? ",\n" : "\n");
+				out<<"    {\"name\": \""<<r.name<<"\", \"iterations\": "<<r.iterations
+				   <<", \"ns_per_op\": "<<r.ns_per_op<<", \"min_ns_per_op\": "<<r.min_ns_per_op<<"}";
+			}
+			out<<"\n  ]\n}\n";
+		}
+	};
+
+	/// A context with no output, to measure the rules and not the terminal.
+	std::shared_ptr<Context> quiet_context(){
+		auto ctx=std::make_shared<Context>();
+		ctx->set_output([](const std::string &){});
+		return ctx;
+	}
+
+	const char *monitor_rules[]={
+		"mem.total 1", // Initial values, to prevent non defined errors
+		"_cpu.sum 0",
+		"_disk.read 0",
+		"_net.write 0",
+		":_.cpu.sum_d  at timestamp do _cpu.sum_d  = sum( cpu.cpu.* ) - _cpu.sum",
+		":_.cpu.sum    at timestamp do _cpu.sum    = sum( cpu.cpu.* )",
+		":disk.read_d  at timestamp do easy.disk.read = (( sum( disk.?d?.read ) - _disk.read ) * 512 )",
+		":disk.read    at timestamp do _disk.read = sum( disk.?d?.read )",
+		":net.write_d  at timestamp do easy.net.write = ( sum( net.*.write ) - _net.write )",
+		":net.write    at timestamp do _net.write = sum( net.*.write )",
+		":mem.free%    mem.free% = (mem.free * 100.0) / mem.total",
+	};
+
+	/// Metric lines as the monitor sends them, a frame of keys and then its timestamp.
+	std::vector<std::string> generate_lines(size_t count){
+		std::mt19937 rng(42);
+		std::vector<std::string> keys;
+		for(int i=0;i<8;i++){
+			keys.push_back("cpu.cpu"+std::to_string(i)+".user");
+			keys.push_back("cpu.cpu"+std::to_string(i)+".idle");
+		}
+		for(char d='a';d<'e';d++){
+			keys.push_back(std::string("disk.sd")+d+".read");
+			keys.push_back(std::string("disk.sd")+d+".write");
+		}
+		for(int i=0;i<4;i++){
+			keys.push_back("net.eth"+std::to_string(i)+".read");
+			keys.push_back("net.eth"+std::to_string(i)+".write");
+		}
+		keys.push_back("mem.free");
+		keys.push_back("mem.total");
+
+		std::vector<std::string> lines;
+		int64_t timestamp=1400000000;
+		while (lines.size()<count){
+			for(auto &key: keys)
+				lines.push_back(key+" "+std::to_string(rng()%100000));
+			lines.push_back("timestamp "+std::to_string(timestamp++));
+		}
+		lines.resize(count);
+		return lines;
+	}
+
+	void bench_glob(Bench &bench){
+		const std::pair<const char*, const char*> cases[]={
+			{"literal", "disk.sda.read"},
+			{"question", "disk.?d?.read"},
+			{"star", "net.*.write"},
+			{"star_miss", "mem.*"},
+		};
+		const char *texts[]={"disk.sda.read", "net.eth0.write", "cpu.cpu12.idle", "mem.free"};
+		for(auto &c: cases){
+			auto globstr=c.second;
+			bench.run(std::string("glob_match/")+c.first, [globstr, &texts](uint64_t n){
+				for(uint64_t i=0;i<n;i++)
+					keep(glob_match(texts[i&3], globstr));
+			});
+			Glob glob(globstr);
+			bench.run(std::string("Glob::match/")+c.first, [&glob, &texts](uint64_t n){
+				for(uint64_t i=0;i<n;i++)
+					keep(glob.match(texts[i&3]));
+			});
+		}
+	}
+
+	void bench_parser(Bench &bench){
+		const std::pair<const char*, std::string> cases[]={
+			{"assign", "a.c = a.b * 2 + mem.free"},
+			{"at_sum", "at timestamp do easy.disk.read = (( sum( disk.?d?.read ) - _disk.read ) * 512 )"},
+			{"block", "at timestamp do { x.y = x.y0 + 1 ; x.y0 = x.y ; dbg = debug(x.y, \"hi\", 1.5) ; }"},
+		};
+		for(auto &c: cases){
+			auto &code=c.second;
+			bench.run(std::string("Tokenizer::next/")+c.first, [&code](uint64_t n){
+				for(uint64_t i=0;i<n;i++){
+					Tokenizer tokenizer(code);
+					while (tokenizer.next())
+						;
+					keep(tokenizer);
+				}
+			});
+			bench.run(std::string("parse_program/")+c.first, [&code](uint64_t n){
+				for(uint64_t i=0;i<n;i++)
+					keep(parse_program(code));
+			});
+		}
+		// Each define replaces the program of that name; cached alternates two texts, so all are compiled once
+		auto ctx=quiet_context();
+		std::string code="at timestamp do easy.disk.read = (( sum( disk.?d?.read ) - _disk.read ) * 512 )";
+		bench.run("Context::define/cached", [&ctx, &code](uint64_t n){
+			for(uint64_t i=0;i<n;i++)
+				ctx->feed_secure(":bench.p"+std::to_string(i%1024)+" "+code+(((i/1024)%2) ? " + 1" : ""));
+		});
+		uint64_t unique=0;
+		bench.run("Context::define/uncached", [&ctx, &code, &unique](uint64_t n){
+			for(uint64_t i=0;i<n;i++)
+				ctx->feed_secure(":bench.p"+std::to_string(i%1024)+" "+code+" + "+std::to_string(++unique));
+		});
+	}
+
+	void bench_feed(Bench &bench){
+		auto lines=generate_lines(1<<14);
+		for(auto with_rules: {false, true}){
+			auto ctx=quiet_context();
+			if (with_rules)
+				for(auto rule: monitor_rules)
+					ctx->feed_secure(rule);
+			for(auto &line: lines) // Warm up, so all symbols exist
+				ctx->feed(line);
+			bench.run(std::string("Context::feed/")+(with_rules ? "monitor_rules" : "no_rules"), [&ctx, &lines](uint64_t n){
+				for(uint64_t i=0;i<n;i++)
+					ctx->feed(lines[i%lines.size()]);
+			});
+		}
+	}
+
+	/**
+	 * Level 0 is one symbol; each next level has fanout symbols set from the first one of the
+	 * level before, so a change runs depth*fanout programs.
+	 */
+	void bench_propagation(Bench &bench){
+		for(int depth: {1, 4, 16}){
+			for(int fanout: {1, 4, 16}){
+				auto ctx=quiet_context();
+				ctx->feed_secure("c0.0 0");
+				for(int l=1;l<=depth;l++){
+					for(int i=0;i<fanout;i++){
+						auto name="c"+std::to_string(l)+"."+std::to_string(i);
+						ctx->feed_secure(":"+name+" "+name+" = c"+std::to_string(l-1)+".0 + 1");
+					}
+				}
+				auto &root=ctx->get_value("c0.0");
+				int64_t value=0;
+				bench.run("Symbol::set/depth="+std::to_string(depth)+"/fanout="+std::to_string(fanout), [&ctx, &root, &value](uint64_t n){
+					for(uint64_t i=0;i<n;i++){
+						root.set(to_any(++value), *ctx);
+						ctx->run_scheduled();
+					}
+				});
+			}
+		}
+	}
+
+	/// Context with size symbols `g.N.v`, and as many others that do not match.
+	std::shared_ptr<Context> glob_context(int size){
+		auto ctx=quiet_context();
+		for(int i=0;i<size;i++){
+			ctx->feed("g."+std::to_string(i)+".v "+std::to_string(i));
+			ctx->feed("z."+std::to_string(i)+".v "+std::to_string(i));
+		}
+		return ctx;
+	}
+
+	void bench_glob_values(Bench &bench){
+		for(int size: {100, 1000, 10000}){
+			auto ctx=glob_context(size);
+			for(auto globstr: {"g.*", "g.1?.v", "*.7.v"}){
+				Glob glob(globstr);
+				bench.run("get_glob_values/"+std::string(globstr)+"/size="+std::to_string(size), [&ctx, &glob](uint64_t n){
+					for(uint64_t i=0;i<n;i++)
+						keep(ctx->get_glob_values(glob));
+				});
+			}
+		}
+	}
+
+	void bench_builtins(Bench &bench){
+		auto ctx=glob_context(100);
+		std::vector<any> list_args={ctx->get_glob_values(Glob("g.*"))};
+		for(auto fname: {"sum", "count", "avg", "min", "max"}){
+			bench.run(std::string("builtin/")+fname+"/100", [&ctx, fname, &list_args](uint64_t n){
+				std::string name(fname);
+				for(uint64_t i=0;i<n;i++)
+					keep(ctx->fn(name, list_args));
+			});
+		}
+		std::vector<any> round_args={to_any(3.14159), to_any(int64_t(2))};
+		bench.run("builtin/round", [&ctx, &round_args](uint64_t n){
+			std::string name("round");
+			for(uint64_t i=0;i<n;i++)
+				keep(ctx->fn(name, round_args));
+		});
+		std::vector<any> print_args={to_any(std::string("g.1?.v"))};
+		bench.run("builtin/print/10", [&ctx, &print_args](uint64_t n){
+			std::string name("print");
+			for(uint64_t i=0;i<n;i++)
+				keep(ctx->fn(name, print_args));
+		});
+		std::vector<any> debug_args={to_any(int64_t(1)), to_any(std::string("hi")), to_any(1.5)};
+		bench.run("builtin/debug", [&ctx, &debug_args](uint64_t n){
+			std::string name("debug");
+			std::ostringstream sink;
+			auto cerr_buf=std::cerr.rdbuf(sink.rdbuf()); // debug writes to stderr
+			for(uint64_t i=0;i<n;i++){
+				keep(ctx->fn(name, debug_args));
+				if ((i&1023)==0)
+					sink.str(std::string());
+			}
+			std::cerr.rdbuf(cerr_buf);
+		});
+	}
+}
+
+int main(int argc, char **argv){
+	Bench bench;
+	std::string output;
+	BenchOptions replay;
+	for(int i=1;i<argc;i++){
+		if (argv[i]==std::string("--replay") && i+2<argc){
+			replay.rules=argv[++i];
+			replay.data=argv[++i];
+		}
+		else if (argv[i]==std::string("--replay-loops") && i+1<argc)
+			replay.loops=atoi(argv[++i]);
+		else if (argv[i]==std::string("--backfill-threads") && i+1<argc)
+			replay.backfill_threads=atoi(argv[++i]);
+		else if (argv[i]==std::string("--batch-marker") && i+1<argc)
+			replay.batch.marker=argv[++i];
+		else if (argv[i]==std::string("--batch-lines") && i+1<argc)
+			replay.batch.lines=atoi(argv[++i]);
+		else if (argv[i]==std::string("--batch-ms") && i+1<argc)
+			replay.batch.time=std::chrono::milliseconds(atoi(argv[++i]));
+		else if (argv[i]==std::string("--units"))
+			loglang::units=true;
+		else if (argv[i]==std::string("--filter") && i+1<argc)
+			bench.filter=argv[++i];
+		else if (argv[i]==std::string("--min-ms") && i+1<argc)
+			bench.min_time=std::chrono::milliseconds(atoi(argv[++i]));
+		else if (argv[i]==std::string("--repetitions") && i+1<argc)
+			bench.repetitions=std::max(1, atoi(argv[++i]));
+		else if (argv[i]==std::string("-o") && i+1<argc)
+			output=argv[++i];
+		else{
+			std::cerr<<"Usage: "<<argv[0]<<" [--filter text] [--min-ms ms] [--repetitions n] [-o results.json]"<<std::endl;
+			std::cerr<<"       "<<argv[0]<<" --replay rules data [--replay-loops n] [--backfill-threads n] [--batch-marker key] [--batch-lines n] [--batch-ms ms] [--units]"<<std::endl;
+			return 1;
+		}
+	}
+	if (!replay.rules.empty())
+		return run_bench(replay);
+
+	bench_glob(bench);
+	bench_parser(bench);
+	bench_feed(bench);
+	bench_propagation(bench);
+	bench_glob_values(bench);
+	bench_builtins(bench);
+
+	if (output.empty())
+		bench.write_json(std::cout);
+	else{
+		std::ofstream out(output);
+		bench.write_json(out);
+		if (!out){
+			std::cerr<<output<<": Can not write the results."<<std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+
+#include "benchmode.hpp"
+#include "feedbox.hpp"
+
+namespace{
+	// Allocations are counted by replacing operator new; only while benchmarking. This file is
+	// only linked into loglang_bench, so the rest do not pay for the check.
+	std::atomic<bool> count_allocations{false};
+	std::atomic<uint64_t> allocations{0};
+}
+
+void *operator new(size_t size)
+{
+	if (count_allocations.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+	if (size==0)
+		size=1;
+	while (true){
+		auto p=malloc(size);
+		if (p)
+			return p;
+		auto handler=std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+// Not inlined into the other deletes, or GCC sees new matched with free and warns
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+	free(p);
+}
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+using namespace loglang;
+
+namespace{
+	/**
+	 * @short Histogram of latencies in ns, with 16 buckets per power of two.
+	 *
+	 * So percentiles are within 6% of the real value, with constant memory and cost per sample.
+	 */
+	class LatencyHistogram{
+		static const int sub_bits=4;
+		std::vector<uint64_t> buckets=std::vector<uint64_t>(64<<sub_bits);
+		uint64_t _count=0;
+		uint64_t _max=0;
+
+		static size_t bucket(uint64_t ns){
+			if (ns<(1<<sub_bits))
+				return ns;
+			int msb=63-__builtin_clzll(ns);
+			return (size_t(msb-sub_bits+1)<<sub_bits) | ((ns>>(msb-sub_bits)) & ((1<<sub_bits)-1));
+		}
+		/// Upper bound of the values at the bucket.
+		static uint64_t bucket_value(size_t b){
+			if (b<(1<<sub_bits))
+				return b;
+			int msb=int(b>>sub_bits)+sub_bits-1;
+			uint64_t low=uint64_t((b & ((1<<sub_bits)-1)) | (1<<sub_bits)) << (msb-sub_bits);
+			return low+(uint64_t(1)<<(msb-sub_bits))-1;
+		}
+	public:
+		void add(uint64_t ns){
+			buckets[bucket(ns)]++;
+			_count++;
+			_max=std::max(_max, ns);
+		}
+		uint64_t count() const { return _count; }
+		uint64_t max() const { return _max; }
+		/// Value under which are that fraction of the samples.
+		uint64_t percentile(double p) const{
+			uint64_t target=uint64_t(p*_count);
+			uint64_t seen=0;
+			for(size_t b=0;b<buckets.size();b++){
+				seen+=buckets[b];
+				if (seen>target)
+					return std::min(bucket_value(b), _max);
+			}
+			return _max;
+		}
+	};
+
+	/**
+	 * @short Feeds the context, and times each line.
+	 *
+	 * The time of a line is from it being split from the read buffer until the feed returns, which
+	 * is after the rules it triggers, or the whole batch it closes with a batch window.
+	 */
+	class TimedTarget : public FeedTarget{
+		using clock=std::chrono::steady_clock;
+		Context &ctx;
+
+		template<typename F>
+		void timed(F &&f){
+			auto start=clock::now();
+			f();
+			latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-start).count());
+		}
+	public:
+		LatencyHistogram latency;
+
+		TimedTarget(Context &ctx) : ctx(ctx){}
+		void feed_secure(std::string_view data) override{ timed([&]{ ctx.feed_secure(data); }); }
+		void feed(std::string_view data) override{ timed([&]{ ctx.feed(data); }); }
+		void feed(const LineSpan &span, bool is_secure) override{ timed([&]{ ctx.feed(span, is_secure); }); }
+		void feed(FeedRecord record) override{ timed([&]{ ctx.feed(std::move(record)); }); }
+		void flush() override{ ctx.flush(); }
+		int flush_expired() override{ return ctx.flush_expired(); }
+	};
+}
+
+int loglang::run_bench(const BenchOptions &opts)
+{
+	using clock=std::chrono::steady_clock;
+	auto context=std::make_shared<Context>();
+	context->set_batch_window(opts.batch);
+	uint64_t outputs=0;
+	context->set_output([&outputs](const std::string &){ outputs++; });
+
+	try{
+		FeedBox rules(context);
+		rules.add_feed(opts.rules, true);
+	}
+	catch(const std::exception &ex){
+		std::cerr<<opts.rules<<": "<<ex.what()<<std::endl;
+		return 1;
+	}
+
+	auto target=std::make_shared<TimedTarget>(*context);
+	auto programs_start=context->programs_run();
+	double seconds=0;
+	allocations=0;
+	for(unsigned loop=0;loop<opts.loops;loop++){
+		auto lines_start=target->latency.count();
+		auto start=clock::now();
+		count_allocations=true;
+		try{
+			FeedBox feedbox(target);
+			feedbox.set_backfill_threads(opts.backfill_threads);
+			feedbox.add_feed(opts.data, false); // Reads it all
+			target->flush();
+		}
+		catch(const std::exception &ex){
+			count_allocations=false;
+			std::cerr<<opts.data<<": "<<ex.what()<<std::endl;
+			return 1;
+		}
+		count_allocations=false;
+		auto loop_seconds=std::chrono::duration<double>(clock::now()-start).count();
+		seconds+=loop_seconds;
+		std::cerr<<"Loop "<<loop+1<<": "<<uint64_t((target->latency.count()-lines_start)/loop_seconds)<<" lines/s"<<std::endl;
+	}
+
+	auto &latency=target->latency;
+	auto lines=latency.count();
+	auto programs=context->programs_run()-programs_start;
+	if (lines==0){
+		std::cerr<<opts.data<<": No lines to replay."<<std::endl;
+		return 1;
+	}
+	std::cout<<"loops: "<<opts.loops<<std::endl;
+	if (opts.backfill_threads>1)
+		std::cout<<"path: records, "<<opts.backfill_threads<<" backfill threads"<<std::endl;
+	else
+		std::cout<<"path: lines"<<std::endl;
+	std::cout<<"lines: "<<lines<<std::endl;
+	std::cout<<"seconds: "<<seconds<<std::endl;
+	std::cout<<"lines/s: "<<uint64_t(lines/seconds)<<std::endl;
+	std::cout<<"programs run: "<<programs<<std::endl;
+	std::cout<<"programs/s: "<<uint64_t(programs/seconds)<<std::endl;
+	std::cout<<"outputs: "<<outputs<<std::endl;
+	std::cout<<"allocations/line: "<<double(allocations)/lines<<std::endl;
+	std::cout<<"latency ns: p50 "<<latency.percentile(0.5)<<" p90 "<<latency.percentile(0.9)<<" p99 "<<latency.percentile(0.99)
+		<<" p99.9 "<<latency.percentile(0.999)<<" max "<<latency.max()<<std::endl;
+	return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "context.hpp"
+
+namespace loglang{
+	/**
+	 * @short What `loglang_bench --replay rules data` runs.
+	 *
+	 * The rules are loaded once, and then the data file is replayed loops times, each through a
+	 * new FeedBox as when the file is added, to the same Context.
+	 */
+	class BenchOptions{
+	public:
+		std::string rules;
+		std::string data;
+		unsigned loops=5;
+		unsigned backfill_threads=0; // 1 or less feeds it line by line, as pipes and small files
+		BatchWindow batch;
+	};
+
+	/**
+	 * @short Runs the benchmark and writes the report to stdout.
+	 *
+	 * Reports lines and programs run per second, allocations per line, and the percentiles of
+	 * the time from each line being split from the read buffer to the end of the rules it runs.
+	 * Returns the exit code.
+	 */
+	int run_bench(const BenchOptions &opts);
+}
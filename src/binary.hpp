@@ -0,0 +1,177 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include "value.hpp"
+
+namespace loglang{
+	inline uint64_t fnv1a(const char *data, size_t len){
+		uint64_t h=1469598103934665603ull;
+		for(size_t i=0;i<len;i++){
+			h^=(unsigned char)data[i];
+			h*=1099511628211ull;
+		}
+		return h;
+	}
+
+	/**
+	 * @short Appends values to a buffer, in native byte order, for snapshots and the change log.
+	 *
+	 * Values are type:u8 and then i64, f64, u8, str, or n value*. Strings are the length and
+	 * the bytes. Compact writes lengths and ints as varints, else lengths are u32.
+	 */
+	class BinaryWriter{
+	public:
+		std::string buffer;
+		bool compact;
+
+		BinaryWriter(bool compact=false) : compact(compact){}
+
+		template<typename T>
+		void put(T v){
+			buffer.append((const char*)&v, sizeof(v));
+		}
+		void put_varint(uint64_t v){
+			while (v>=0x80){
+				buffer.push_back(char(v | 0x80));
+				v>>=7;
+			}
+			buffer.push_back(char(v));
+		}
+		void put_length(size_t n){
+			if (compact)
+				put_varint(n);
+			else
+				put(uint32_t(n));
+		}
+		void put_str(std::string_view s){
+			put_length(s.length());
+			buffer.append(s.data(), s.length());
+		}
+		void put_value(const any &v){
+			put(uint8_t(v.type()));
+			switch(v.type()){
+				case any::NONE:
+					break;
+				case any::INT:
+					if (compact){
+						auto i=v.to_int();
+						put_varint((uint64_t(i)<<1) ^ uint64_t(i>>63)); // Zigzag, small negatives are short too
+					}
+					else
+						put(v.to_int());
+					break;
+				case any::DOUBLE:
+					put(v.to_double());
+					break;
+				case any::BOOL:
+					put(uint8_t(v.to_bool()));
+					break;
+				case any::STRING:
+					put_str(v.to_string());
+					break;
+				case any::LIST:
+					put_length(v.to_list().size());
+					for(auto &e: v.to_list())
+						put_value(e);
+					break;
+			}
+		}
+	};
+
+	/// Reads what BinaryWriter writes; any read past the end throws.
+	class BinaryReader{
+		const char *p, *end;
+		bool compact;
+	public:
+		BinaryReader(const char *data, size_t len, bool compact=false) : p(data), end(data+len), compact(compact){}
+
+		bool at_end() const { return p==end; }
+		void need(size_t n){
+			if (size_t(end-p)<n)
+				throw std::runtime_error("Truncated data");
+		}
+		template<typename T>
+		T get(){
+			need(sizeof(T));
+			T v;
+			memcpy(&v, p, sizeof(T));
+			p+=sizeof(T);
+			return v;
+		}
+		uint64_t get_varint(){
+			uint64_t v=0;
+			for(int shift=0;shift<64;shift+=7){
+				auto b=get<uint8_t>();
+				v|=uint64_t(b & 0x7f)<<shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			throw std::runtime_error("Corrupt varint");
+		}
+		size_t get_length(){
+			if (compact)
+				return get_varint();
+			return get<uint32_t>();
+		}
+		std::string_view get_str(){
+			auto len=get_length();
+			need(len);
+			std::string_view s(p, len);
+			p+=len;
+			return s;
+		}
+		any get_value(int depth=0){
+			if (depth>64)
+				throw std::runtime_error("Corrupt value");
+			switch(get<uint8_t>()){
+				case any::NONE:
+					return any();
+				case any::INT:
+					if (compact){
+						auto z=get_varint();
+						return any(int64_t(z>>1) ^ -int64_t(z & 1));
+					}
+					return any(get<int64_t>());
+				case any::DOUBLE:
+					return any(get<double>());
+				case any::BOOL:
+					return any(get<uint8_t>()!=0);
+				case any::STRING:
+					return any(std::string(get_str()));
+				case any::LIST:{
+					auto n=get_length();
+					need(n); // At least a byte each
+					std::vector<any> list;
+					list.reserve(n);
+					for(size_t i=0;i<n;i++)
+						list.push_back(get_value(depth+1));
+					return any(std::move(list));
+				}
+				default:
+					throw std::runtime_error("Corrupt value");
+			}
+		}
+	};
+}
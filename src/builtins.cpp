@@ -16,36 +16,74 @@
 
 #include <iostream>
 #include <math.h>
+#include <stdexcept>
+#include <functional>
 
 #include "builtins.hpp"
 #include "context.hpp"
 
 namespace loglang{
 	namespace builtins{
-		static any sum(Context&, const std::vector<any> &vars){
-			double n=0.0;
+		/// Calls f with each value, and each element of list values.
+		template<typename F>
+		static void for_each_value(const std::vector<any> &vars, F f){
 			for(auto &v: vars){
-				try{
-					auto &operands=v->to_list();
-					for (auto &op: operands)
-						n+=op->to_double();
-				}
-				catch(const value_base::invalid_conversion &e){
-					n+=v->to_double();
+				if (v.type()==any::LIST){
+					for (auto &op: v.to_list())
+						f(op);
 				}
+				else
+					f(v);
 			}
+		}
+		static any sum(Context&, const std::vector<any> &vars){
+			double n=0.0;
+			for_each_value(vars, [&n](const any &v){ n+=v.to_double(); });
+			return to_any( n );
+		}
+		static any count(Context&, const std::vector<any> &vars){
+			int64_t n=0;
+			for_each_value(vars, [&n](const any &){ n++; });
 			return to_any( n );
 		}
+		static any avg(Context&, const std::vector<any> &vars){
+			double n=0.0;
+			int64_t c=0;
+			for_each_value(vars, [&n, &c](const any &v){ n+=v.to_double(); c++; });
+			if (c==0)
+				throw std::runtime_error("avg of no values");
+			return to_any( n/c );
+		}
+		template<typename Cmp>
+		static any best(const char *fname, const std::vector<any> &vars, Cmp cmp){
+			double n=0.0;
+			bool any_value=false;
+			for_each_value(vars, [&](const any &v){
+				auto d=v.to_double();
+				if (!any_value || cmp(d, n))
+					n=d;
+				any_value=true;
+			});
+			if (!any_value)
+				throw std::runtime_error(std::string(fname)+" of no values");
+			return to_any( n );
+		}
+		static any min(Context&, const std::vector<any> &vars){
+			return best("min", vars, std::less<double>());
+		}
+		static any max(Context&, const std::vector<any> &vars){
+			return best("max", vars, std::greater<double>());
+		}
 		static any print(Context &context, const std::vector<any> &vars){
-			auto symlist=context.symboltable_filter(vars[0]->to_string());
+			auto symlist=context.symboltable_filter(vars[0].to_string());
 			for (auto sym: symlist){
 				context.output(sym->name(), std::to_string( sym->get() ));
 			}
 			return to_any( (int64_t)vars.size() );
 		}
 		static any round(Context &context, const std::vector<any> &vars){
-			auto dataitem=vars[0]->to_double();
-			auto ndig=vars[1]->to_double();
+			auto dataitem=vars[0].to_double();
+			auto ndig=vars[1].to_double();
 			double mult=pow(10, ndig);
 	// 		std::cerr<<dataitem<<" "<<mult<<std::endl;
 			return to_any( int( dataitem * mult ) / mult );
@@ -65,6 +103,10 @@ namespace loglang{
 
 void loglang::register_builtins(loglang::Context& context){
 	context.register_function("sum", &loglang::builtins::sum);
+	context.register_function("count", &loglang::builtins::count);
+	context.register_function("avg", &loglang::builtins::avg);
+	context.register_function("min", &loglang::builtins::min);
+	context.register_function("max", &loglang::builtins::max);
 	context.register_function("print", &loglang::builtins::print);
 	context.register_function("round", &loglang::builtins::round);
 	context.register_function("debug", &loglang::builtins::debug);
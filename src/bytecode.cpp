@@ -0,0 +1,150 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+
+#include "bytecode.hpp"
+#include "ast.hpp"
+#include "aggregate.hpp"
+
+using namespace loglang;
+
+static const char *opnames[]={
+	"NOP", "NIL", "CONST", "LOAD", "GLOB", "STORE",
+	"ADD", "SUB", "MUL", "DIV", "LT", "LTE", "GT", "GTE", "EQ", "NEQ", "AND", "OR",
+	"CALL", "JMP", "JF", "EDGE", "AT", "AGG", "CAPTURE"
+};
+
+template<typename T>
+static uint16_t add_unique(std::vector<T> &table, const T &val){
+	auto I=std::find(std::begin(table), std::end(table), val);
+	if (I!=std::end(table))
+		return I-std::begin(table);
+	if (table.size()>=std::numeric_limits<uint16_t>::max())
+		throw std::runtime_error("Program too big.");
+	table.push_back(val);
+	return table.size()-1;
+}
+
+uint16_t Compiler::reg()
+{
+	if (next_register==std::numeric_limits<uint16_t>::max())
+		throw std::runtime_error("Program too big, out of registers.");
+	auto r=next_register++;
+	if (next_register>bc.nregisters)
+		bc.nregisters=next_register;
+	return r;
+}
+
+size_t Compiler::emit(Instr::op_t op, uint16_t dst, uint16_t a, uint16_t b)
+{
+	if (bc.code.size()>=std::numeric_limits<uint16_t>::max())
+		throw std::runtime_error("Program too big.");
+	bc.code.emplace_back(op, dst, a, b);
+	return bc.code.size()-1;
+}
+
+uint16_t Compiler::constant(any val)
+{
+	bc.constants.push_back(std::move(val));
+	return bc.constants.size()-1;
+}
+
+uint16_t Compiler::symbol(const std::string &name)
+{
+	return add_unique(bc.symbols, name);
+}
+
+uint16_t Compiler::glob(const std::string &name)
+{
+	return add_unique(bc.globs, name);
+}
+
+uint16_t Compiler::function(const std::string &name)
+{
+	return add_unique(bc.functions, name);
+}
+
+uint16_t Compiler::aggregate(const std::string &glob)
+{
+	return add_unique(bc.aggregates, glob);
+}
+
+uint16_t Compiler::state()
+{
+	return bc.nstate++;
+}
+
+void loglang::compile(ASTBase &ast, Bytecode &bc)
+{
+	Compiler compiler(bc);
+	bc.result=ast.compile(compiler);
+}
+
+std::string Bytecode::to_string() const
+{
+	std::stringstream ss;
+	ss<<"; "<<nregisters<<" registers, "<<nstate<<" state, result at r"<<result<<std::endl;
+	for(size_t i=0;i<code.size();i++){
+		auto &in=code[i];
+		ss<<i<<"\t"<<opnames[in.op]<<"\t";
+		switch(in.op){
+			case Instr::NOP:
+				break;
+			case Instr::NIL:
+				ss<<"r"<<in.dst;
+				break;
+			case Instr::CONST:
+				ss<<"r"<<in.dst<<", "<<std::to_string(constants[in.a]);
+				break;
+			case Instr::LOAD:
+				ss<<"r"<<in.dst<<", "<<symbols[in.a];
+				break;
+			case Instr::GLOB:
+				ss<<"r"<<in.dst<<", "<<globs[in.a];
+				break;
+			case Instr::STORE:
+				ss<<symbols[in.a]<<", r"<<in.b;
+				break;
+			case Instr::CALL:
+				ss<<"r"<<in.dst<<", "<<functions[in.a]<<"/"<<in.b;
+				break;
+			case Instr::JMP:
+				ss<<in.a;
+				break;
+			case Instr::JF:
+				ss<<in.a<<", r"<<in.b;
+				break;
+			case Instr::EDGE:
+			case Instr::AT:
+				ss<<"s"<<in.dst<<", "<<in.a<<", r"<<in.b;
+				break;
+			case Instr::AGG:
+				ss<<"r"<<in.dst<<", "<<GlobAggregate::kind_name(GlobAggregate::kind_t(in.b))<<" "<<aggregates[in.a];
+				break;
+			case Instr::CAPTURE:
+				ss<<"r"<<in.dst<<", $"<<in.a;
+				break;
+			default:
+				ss<<"r"<<in.dst<<", r"<<in.a<<", r"<<in.b;
+		}
+		ss<<std::endl;
+	}
+	return ss.str();
+}
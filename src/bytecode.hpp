@@ -0,0 +1,121 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "value.hpp"
+
+namespace loglang{
+	/**
+	 * @short One VM instruction
+	 *
+	 * All instructions have the same layout, a destination register and two operands. Depending on the
+	 * opcode operands are registers, indexes into the bytecode tables, or jump targets.
+	 */
+	class Instr{
+	public:
+		enum op_t : uint16_t{
+			NOP=0,
+			NIL,     // dst = null
+			CONST,   // dst = constants[a]
+			LOAD,    // dst = symbols[a], throws if undefined
+			GLOB,    // dst = list of values of globs[a]
+			STORE,   // symbols[a] = b
+			ADD,     // dst = a + b
+			SUB,
+			MUL,
+			DIV,
+			LT,
+			LTE,
+			GT,
+			GTE,
+			EQ,
+			NEQ,
+			AND,
+			OR,
+			CALL,    // dst = functions[a]( dst ... dst+b-1 )
+			JMP,     // goto a
+			JF,      // if !b goto a
+			EDGE,    // if to_bool(b)==state[dst] goto a, else state[dst]=to_bool(b)
+			AT,      // if b==state[dst] goto a, else state[dst]=b
+			AGG,     // dst = aggregates[a] of kind b (sum, count...)
+			CAPTURE, // dst = group a of the regex rule match
+		};
+		op_t op;
+		uint16_t dst;
+		uint16_t a;
+		uint16_t b;
+
+		Instr(op_t op, uint16_t dst, uint16_t a, uint16_t b) : op(op), dst(dst), a(a), b(b){}
+	};
+
+	/**
+	 * @short Compiled form of a program
+	 *
+	 * Flat list of instructions plus the tables they index. Registers and state slots are not stored
+	 * here, just its count; registers are allocated by the VM on each run, and state (previous values
+	 * for edge_if and at) is owned by the Program.
+	 */
+	class Bytecode{
+	public:
+		std::vector<Instr> code;
+		std::vector<any> constants;
+		std::vector<std::string> symbols;
+		std::vector<std::string> globs;
+		std::vector<std::string> functions;
+		std::vector<std::string> aggregates; // Globs whose aggregates are read with AGG
+		uint16_t nregisters=0;
+		uint16_t nstate=0;
+		uint16_t result=0; // Register that holds the program result at the end.
+
+		std::string to_string() const;
+	};
+
+	/**
+	 * @short Helper to lower the AST into Bytecode.
+	 *
+	 * Registers are allocated as an stack: each AST node leaves its result at the first free register
+	 * when it started compiling, and may use any register above as temporary.
+	 */
+	class Compiler{
+		Bytecode &bc;
+		uint16_t next_register=0;
+	public:
+		Compiler(Bytecode &bc) : bc(bc){}
+
+		uint16_t mark() const { return next_register; }
+		uint16_t reg();
+		void release(uint16_t mark){ next_register=mark; }
+
+		size_t emit(Instr::op_t op, uint16_t dst=0, uint16_t a=0, uint16_t b=0);
+		size_t here() const { return bc.code.size(); }
+		void patch(size_t jmp){ bc.code[jmp].a=here(); }
+
+		uint16_t constant(any val);
+		uint16_t symbol(const std::string &name);
+		uint16_t glob(const std::string &name);
+		uint16_t function(const std::string &name);
+		uint16_t aggregate(const std::string &glob);
+		uint16_t state();
+	};
+
+	class ASTBase;
+	void compile(ASTBase &ast, Bytecode &bc);
+}
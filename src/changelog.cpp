@@ -0,0 +1,361 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "changelog.hpp"
+#include "context.hpp"
+#include "program.hpp"
+
+namespace loglang{
+	extern bool debug;
+}
+
+using namespace loglang;
+
+/*
+ * Segment layout, in native byte order, as it is only read back at the same host:
+ *
+ *   magic[8] version:u32 segment:u64
+ *   { len:u32 checksum:u64 record* }*   frames; the checksum is FNV-1a of the records
+ *
+ * Records are type:u8 and then, with varints and compact values as BinaryWriter writes them:
+ *
+ *   NAME   id name:str       ids are consecutive from 0 at each segment
+ *   SET    id value          symbol value
+ *   DEFINE line:str          as fed, `:name code` or `/regex/ code`, empty code removes it
+ *   STATE  id n value*       at and edge_if state of the program
+ */
+namespace{
+	const char magic[8]={'L','O','G','L','C','L','O','G'};
+	const uint32_t version=1;
+	const size_t frame_header=sizeof(uint32_t)+sizeof(uint64_t);
+	const size_t segment_header=sizeof(magic)+sizeof(uint32_t)+sizeof(uint64_t);
+	const size_t max_frame=1<<20; // Written before commit when it grows that much
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+	while (len>0){
+		auto n=write(fd, data, len);
+		if (n<0 && errno==EINTR)
+			continue;
+		if (n<0)
+			throw std::runtime_error(std::string("Writing change log: ")+strerror(errno));
+		data+=n;
+		len-=n;
+	}
+}
+
+ChangeLog::ChangeLog(Options _options, uint64_t first_segment) : options(std::move(_options))
+{
+	auto existing=segments(options.path);
+	_segment=std::max<uint64_t>(1, first_segment);
+	if (!existing.empty())
+		_segment=std::max(_segment, existing.back().first+1);
+	remove_before(first_segment);
+	clear_frame();
+}
+
+ChangeLog::~ChangeLog()
+{
+	try{
+		rotate();
+	}
+	catch(const std::exception &e){
+		std::cerr<<e.what()<<std::endl;
+	}
+}
+
+void ChangeLog::clear_frame()
+{
+	frame.buffer.assign(frame_header, '\0');
+}
+
+uint32_t ChangeLog::new_name(const std::string &name)
+{
+	auto id=next_id++;
+	frame.put(uint8_t(NAME));
+	frame.put_varint(id);
+	frame.put_str(name);
+	return id;
+}
+
+void ChangeLog::set(Symbol &symbol)
+{
+	auto I=symbol_ids.find(&symbol);
+	uint32_t id;
+	if (I!=std::end(symbol_ids))
+		id=I->second;
+	else
+		symbol_ids.emplace(&symbol, id=new_name(symbol.name()));
+	frame.put(uint8_t(SET));
+	frame.put_varint(id);
+	frame.put_value(symbol.get());
+	_records++;
+	if (frame.buffer.size()>=max_frame){
+		try{
+			write_frame();
+		}
+		catch(const std::exception &){
+			// Kept at the buffer; commit tries again, and throws
+		}
+	}
+}
+
+void ChangeLog::define(const std::string &line)
+{
+	program_ids.clear();
+	frame.put(uint8_t(DEFINE));
+	frame.put_str(line);
+	_records++;
+}
+
+void ChangeLog::state(const Program &program)
+{
+	auto I=program_ids.find(&program);
+	uint32_t id;
+	if (I!=std::end(program_ids))
+		id=I->second;
+	else
+		program_ids.emplace(&program, id=new_name(program.name()));
+	frame.put(uint8_t(STATE));
+	frame.put_varint(id);
+	frame.put_length(program.vm_state().size());
+	for(auto &v: program.vm_state())
+		frame.put_value(v);
+	_records++;
+}
+
+void ChangeLog::write_frame()
+{
+	if (frame.buffer.size()<=frame_header)
+		return;
+	if (fd<0){
+		auto filename=segment_filename(options.path, _segment);
+		fd=open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+		if (fd<0)
+			throw std::runtime_error(filename+": "+strerror(errno));
+		BinaryWriter header;
+		header.buffer.append(magic, sizeof(magic));
+		header.put(version);
+		header.put(_segment);
+		write_all(fd, header.buffer.data(), header.buffer.size());
+		segment_bytes=header.buffer.size();
+	}
+	uint32_t len=frame.buffer.size()-frame_header;
+	uint64_t checksum=fnv1a(frame.buffer.data()+frame_header, len);
+	memcpy(&frame.buffer[0], &len, sizeof(len));
+	memcpy(&frame.buffer[sizeof(len)], &checksum, sizeof(checksum));
+	try{
+		write_all(fd, frame.buffer.data(), frame.buffer.size());
+	}
+	catch(const std::exception &){
+		if (ftruncate(fd, segment_bytes)<0){} // No half frame before the retry
+		throw;
+	}
+	segment_bytes+=frame.buffer.size();
+	clear_frame();
+	if (!unsynced){
+		unsynced=true;
+		sync_due=std::chrono::steady_clock::now()+options.sync_interval;
+	}
+	if (segment_bytes>=options.segment_size)
+		rotate();
+}
+
+int ChangeLog::commit()
+{
+	write_frame();
+	if (!unsynced)
+		return -1;
+	auto now=std::chrono::steady_clock::now();
+	if (now<sync_due)
+		return std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(sync_due-now).count());
+	if (fdatasync(fd)<0)
+		throw std::runtime_error(std::string("Syncing change log: ")+strerror(errno));
+	unsynced=false;
+	return -1;
+}
+
+void ChangeLog::rotate()
+{
+	write_frame();
+	if (fd>=0){
+		if (fdatasync(fd)<0 || close(fd)<0){
+			auto err=errno;
+			fd=-1;
+			throw std::runtime_error(std::string("Closing change log: ")+strerror(err));
+		}
+		fd=-1;
+	}
+	unsynced=false;
+	_segment++;
+	segment_bytes=0;
+	symbol_ids.clear();
+	program_ids.clear();
+	next_id=0;
+}
+
+void ChangeLog::remove_before(uint64_t segment)
+{
+	for(auto &seg: segments(options.path)){
+		if (seg.first>=segment)
+			break;
+		if (unlink(seg.second.c_str())<0)
+			std::cerr<<seg.second<<": "<<strerror(errno)<<std::endl;
+	}
+}
+
+std::string ChangeLog::segment_filename(const std::string &path, uint64_t segment)
+{
+	char suffix[24];
+	snprintf(suffix, sizeof(suffix), ".%08llu", (unsigned long long)segment);
+	return path+suffix;
+}
+
+std::vector<std::pair<uint64_t, std::string>> ChangeLog::segments(const std::string &path)
+{
+	auto slash=path.rfind('/');
+	std::string dirname=(slash==std::string::npos) ? "." : path.substr(0, slash+1);
+	std::string prefix=((slash==std::string::npos) ? path : path.substr(slash+1))+".";
+	std::vector<std::pair<uint64_t, std::string>> ret;
+	auto dir=opendir(dirname.c_str());
+	if (!dir)
+		return ret;
+	while (auto entry=readdir(dir)){
+		std::string_view name(entry->d_name);
+		if (name.length()<=prefix.length() || name.substr(0, prefix.length())!=prefix)
+			continue;
+		auto number=name.substr(prefix.length());
+		if (!std::all_of(std::begin(number), std::end(number), [](char c){ return c>='0' && c<='9'; }))
+			continue;
+		ret.emplace_back(std::stoull(std::string(number)), (slash==std::string::npos) ? std::string(name) : dirname+std::string(name));
+	}
+	closedir(dir);
+	std::sort(std::begin(ret), std::end(ret));
+	return ret;
+}
+
+uint64_t Context::replay_change_log(const std::string &path, uint64_t first_segment)
+{
+	uint64_t applied=0;
+	for(auto &seg: ChangeLog::segments(path)){
+		if (seg.first<first_segment)
+			continue;
+		auto &filename=seg.second;
+		int fd=open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd<0)
+			throw std::runtime_error(filename+": "+strerror(errno));
+		struct stat st;
+		if (fstat(fd, &st)<0){
+			close(fd);
+			throw std::runtime_error(filename+": "+strerror(errno));
+		}
+		size_t size=st.st_size;
+		if (size<segment_header){ // Crashed as it was created
+			close(fd);
+			continue;
+		}
+		auto map=(const char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map==MAP_FAILED)
+			throw std::runtime_error(filename+": "+strerror(errno));
+
+		try{
+			BinaryReader header(map, segment_header);
+			if (memcmp(map, magic, sizeof(magic))!=0)
+				throw std::runtime_error("Not a change log segment");
+			header.get<uint64_t>(); // Magic
+			if (header.get<uint32_t>()!=version)
+				throw std::runtime_error("Unknown change log version");
+
+			std::vector<std::string> names;
+			std::vector<Symbol*> symbols; // Resolved on first use
+			size_t pos=segment_header;
+			while (pos<size){
+				uint32_t len;
+				uint64_t checksum;
+				if (size-pos<frame_header)
+					break;
+				memcpy(&len, map+pos, sizeof(len));
+				memcpy(&checksum, map+pos+sizeof(len), sizeof(checksum));
+				if (size-pos-frame_header<len || fnv1a(map+pos+frame_header, len)!=checksum)
+					break;
+				BinaryReader r(map+pos+frame_header, len, true);
+				while (!r.at_end()){
+					switch(r.get<uint8_t>()){
+						case ChangeLog::NAME:{
+							if (r.get_varint()!=names.size())
+								throw std::runtime_error("Corrupt change log name");
+							names.emplace_back(r.get_str());
+							symbols.push_back(nullptr);
+						}
+						break;
+						case ChangeLog::SET:{
+							auto id=r.get_varint();
+							if (id>=names.size())
+								throw std::runtime_error("Corrupt change log name");
+							if (!symbols[id])
+								symbols[id]=&get_value(names[id]);
+							symbols[id]->restore(r.get_value());
+						}
+						break;
+						case ChangeLog::DEFINE:
+							define_program(std::string(r.get_str()));
+							break;
+						case ChangeLog::STATE:{
+							auto id=r.get_varint();
+							if (id>=names.size())
+								throw std::runtime_error("Corrupt change log name");
+							auto n=r.get_length();
+							std::vector<any> state;
+							for(size_t i=0;i<n;i++)
+								state.push_back(r.get_value());
+							auto prog=find_program(names[id]);
+							if (prog)
+								prog->restore_state(std::move(state));
+						}
+						break;
+						default:
+							throw std::runtime_error("Corrupt change log record");
+					}
+					applied++;
+				}
+				pos+=frame_header+len;
+			}
+			if (pos<size)
+				std::cerr<<filename<<": Torn frame at byte "<<pos<<", as of a crash; the rest is ignored."<<std::endl;
+		}
+		catch(const std::exception &e){
+			munmap((void*)map, size);
+			throw std::runtime_error(filename+": "+e.what());
+		}
+		munmap((void*)map, size);
+	}
+	if (debug)
+		std::cerr<<"Change log replayed from "<<path<<", "<<applied<<" records."<<std::endl;
+	return applied;
+}
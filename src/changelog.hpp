@@ -0,0 +1,91 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+#include "binary.hpp"
+
+namespace loglang{
+	class Symbol;
+	class Program;
+
+	/**
+	 * @short Append only log of symbol changes, program definitions and program state.
+	 *
+	 * Records are kept at a buffer, and written as a checksummed frame at commit, or when the
+	 * buffer is big; the file is synced at most every sync interval, so all the changes in that
+	 * time share a single sync. Names are given a numeric id at their first record at each
+	 * segment, and later records use the id.
+	 *
+	 * The log is split in numbered segment files, path.00000001 and so on. Each start, and
+	 * each snapshot, writes to a new one, so a torn frame of a crash is always at the end of
+	 * its segment, and the segments before the snapshot can be removed.
+	 */
+	class ChangeLog{
+	public:
+		enum record_t : uint8_t{ NAME=1, SET, DEFINE, STATE };
+		class Options{
+		public:
+			std::string path;
+			std::chrono::milliseconds sync_interval{100}; // 0 syncs at each commit
+			size_t segment_size=64<<20;
+		};
+	private:
+		Options options;
+		int fd=-1; // Of the current segment, opened at its first write
+		uint64_t _segment;
+		size_t segment_bytes=0;
+		BinaryWriter frame{true}; // Header room and the pending records
+		std::unordered_map<const Symbol*, uint32_t> symbol_ids;
+		std::unordered_map<const Program*, uint32_t> program_ids; // Cleared at each definition, as pointers are reused
+		uint32_t next_id=0;
+		bool unsynced=false;
+		std::chrono::steady_clock::time_point sync_due;
+		uint64_t _records=0;
+
+		uint32_t new_name(const std::string &name);
+		void clear_frame();
+		void write_frame();
+	public:
+		/// Writes to a new segment, after the existing ones and first_segment; the ones before it are removed.
+		ChangeLog(Options options, uint64_t first_segment=0);
+		~ChangeLog();
+
+		void set(Symbol &symbol);
+		void define(const std::string &line);
+		void state(const Program &program);
+
+		/// Writes the pending records, and syncs if due. Returns the milliseconds until the next sync is due, or -1.
+		int commit();
+		/// Writes and syncs the pending records, and closes the segment; the next write goes to the next one.
+		void rotate();
+		/// Removes the segment files before that one.
+		void remove_before(uint64_t segment);
+		/// Current segment number.
+		uint64_t segment() const { return _segment; }
+		uint64_t records() const { return _records; }
+
+		/// Segment numbers and file names at path, in order.
+		static std::vector<std::pair<uint64_t, std::string>> segments(const std::string &path);
+		static std::string segment_filename(const std::string &path, uint64_t segment);
+	};
+}
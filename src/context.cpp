@@ -18,19 +18,24 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include "context.hpp"
 #include "program.hpp"
 #include "glob.hpp"
 #include "utils.hpp"
 #include "builtins.hpp"
+#include "number.hpp"
 
 namespace loglang{
 	extern bool debug;
+	extern bool units;
 }
 
 using namespace loglang;
 
+
 Context::Context()
 {
 	_output=[](const std::string &str){
@@ -38,73 +43,327 @@ Context::Context()
 	};
 	
 	register_builtins(*this);
+	percent=&get_value("%");
+}
+
+void Context::feed_secure(std::string_view data)
+{
+	feed(LineScanner::split(data.data(), data.length()), true);
+}
+
+bool Context::split_program(const std::string &line, std::string &name, std::string &code)
+{
+	size_t end;
+	if (line.length()>0 && line[0]=='/'){ // Up to the closing slash
+		for(end=1;end<line.length() && line[end]!='/';end++){
+			if (line[end]=='\\')
+				end++;
+		}
+		if (end>=line.length())
+			return false;
+		end++;
+	}
+	else
+		end=line.find_first_of(' ');
+	name=line.substr(0, end);
+	code=(end<line.length()) ? line.substr(end) : std::string();
+	trim(code);
+	return true;
 }
 
-void Context::feed_secure(std::string data)
-{
-	if (data.length()>0 && data[0]==':'){ // New program
-		auto colonpos=data.find_first_of(' ');
-		auto key=data.substr(0, colonpos);
-		if (colonpos>=data.length()){ // Remove, no program
-			auto prog=programs[key];
-			for (auto &dep: prog->dependencies()){
-				get_value(dep).remove_program(prog);
-				
-				auto I=std::begin(glob_dependencies_programs), endI=std::end(glob_dependencies_programs);
-				for(; I != endI; ) {
-					if (I->second==prog) {
-							glob_dependencies_programs.erase(I++);
-					} else {
-						++I;
-					}
-				}
-			}
-			programs.erase(key);
+std::string Context::regex_pattern(const std::string &name)
+{
+	std::string pattern;
+	for(size_t i=1;i+1<name.length();i++){
+		if (name[i]=='\\' && name[i+1]=='/') // Only for the rule syntax, not for the regex
+			i++;
+		pattern+=name[i];
+	}
+	return pattern;
+}
+
+void Context::define_program(const std::string &data)
+{
+	if (_change_log)
+		_change_log->define(data);
+	if (data.length()>0 && data[0]=='/'){
+		define_regex_rule(data);
+		return;
+	}
+	auto colonpos=data.find_first_of(' ');
+	auto key=data.substr(0, colonpos);
+	if (colonpos>=data.length()){ // Remove, no program
+		remove_program(key);
+		return;
+	}
+	auto value=data.substr(colonpos+1);
+	auto I=programs.find(key);
+	if (I!=std::end(programs) && I->second->source()==value) // Same again, keeps its state
+		return;
+	std::shared_ptr<Program> prog;
+	try{
+		prog=std::make_shared<Program>(key, std::move(value), *this);
+	}
+	catch(std::exception &excp){
+		std::cerr<<"Error compiling: "<<excp.what()<<std::endl;
+		return;
+	}
+	
+	if (I!=std::end(programs))
+		I->second->replacement=prog;
+	remove_program(key); // If redefined
+	prog->sequence=++program_sequence;
+	programs[key]=prog;
+	scheduler.invalidate_ranks();
+	for (auto &dep: prog->dependencies()){
+		if (is_glob(dep)){
+//  			std::cerr<<"Glob depend "<<dep<<std::endl;
+			for_each_glob_match(Glob(dep), [&prog](Symbol &sym){
+				sym.run_at_modify(prog);
+			});
+			glob_dependencies.add(dep, prog);
 		}
-		else{ 
-			auto value=data.substr(colonpos+1);
-			std::shared_ptr<Program> prog;
-			try{
-				prog=std::make_shared<Program>(key, std::move(value));
-			}
-			catch(std::exception &excp){
-				std::cerr<<"Error compiling: "<<excp.what()<<std::endl;
-				return;
-			}
-			
-			programs[key]=prog;
-			for (auto &dep: prog->dependencies()){
-				if (std::find(std::begin(dep), std::end(dep), '?')!=std::end(dep) || std::find(std::begin(dep), std::end(dep), '*')!=std::end(dep)){
-//  					std::cerr<<"Glob depend "<<dep<<std::endl;
-					for (auto &key_value: symboltable){
-						if (glob_match(key_value.first, dep)){
-// 							std::cerr<<"Match!"<<std::endl;
-							get_value(key_value.first).run_at_modify(prog);
-						}
-					glob_dependencies_programs[dep]=prog;
-					}
-				}
-				else // No glob
-					get_value(dep).run_at_modify(prog);
-			}
+		else // No glob
+			get_value(dep).run_at_modify(prog);
+	}
+}
+
+/**
+ * Regex rules do not depend on any symbol, they only run when a line matches.
+ */
+void Context::define_regex_rule(const std::string &data)
+{
+	std::string name, code;
+	if (!split_program(data, name, code)){
+		std::cerr<<"Error compiling: regex rule with no closing slash: "<<data<<std::endl;
+		return;
+	}
+	auto pattern=regex_pattern(name);
+	if (code.empty()){
+		regex_rules.remove(pattern);
+		regex_programs.erase(pattern);
+		return;
+	}
+	auto I=regex_programs.find(pattern);
+	if (I!=std::end(regex_programs) && I->second->source()==code)
+		return;
+	std::shared_ptr<Program> prog;
+	try{
+		prog=std::make_shared<Program>(name, std::move(code), *this);
+		regex_rules.add(pattern);
+	}
+	catch(std::exception &excp){
+		std::cerr<<"Error compiling: "<<excp.what()<<std::endl;
+		return;
+	}
+	prog->sequence=++program_sequence;
+	regex_programs[pattern]=prog;
+}
+
+void Context::run_regex_rule(const std::string &pattern, const std::vector<std::string> &captures)
+{
+	auto I=regex_programs.find(pattern);
+	if (I==std::end(regex_programs))
+		return;
+	if (debug){
+		std::cerr<<"Match "<<I->second->name()<<" "<<std::to_string(captures)<<std::endl;
+	}
+	auto prev=this->captures;
+	this->captures=&captures;
+	I->second->run(*this);
+	this->captures=prev;
+}
+
+void Context::feed_match(const std::string &pattern, const std::vector<std::string> &captures)
+{
+	run_regex_rule(pattern, captures);
+	after_feed(std::string());
+}
+
+any Context::capture(size_t n) const
+{
+	if (!captures || n>=captures->size())
+		throw std::runtime_error("No capture $"+std::to_string(n)+" here.");
+	auto &str=(*captures)[n];
+	any value;
+	if (!str.empty() && !isspace(str[0]) && parse_number(str, value, units)==str.length())
+		return value;
+	return to_any(str);
+}
+
+std::shared_ptr<Program> Context::find_program(const std::string &name) const
+{
+	if (!name.empty() && name[0]=='/'){
+		auto I=regex_programs.find(regex_pattern(name));
+		return (I!=std::end(regex_programs)) ? I->second : nullptr;
+	}
+	auto I=programs.find(name);
+	return (I!=std::end(programs)) ? I->second : nullptr;
+}
+
+void Context::remove_program(const std::string &name)
+{
+	auto I=programs.find(name);
+	if (I==std::end(programs))
+		return;
+	auto prog=I->second;
+	for (auto &dep: prog->dependencies()){
+		if (is_glob(dep)){
+			for_each_glob_match(Glob(dep), [&prog](Symbol &sym){
+				sym.remove_program(prog);
+			});
+			glob_dependencies.remove(dep, prog);
 		}
+		else
+			get_value(dep).remove_program(prog);
 	}
-	else{ // Data
-		feed(data);
+	prog->removed=true;
+	programs.erase(I);
+	scheduler.invalidate_ranks();
+}
+
+void Context::feed(std::string_view data){
+	feed(LineScanner::split(data.data(), data.length()), false);
+}
+
+void Context::feed(const LineSpan &span, bool is_secure){
+	if (is_secure && span.raw.length()>0 && (span.raw[0]==':' || span.raw[0]=='/')){ // New program or regex rule
+		define_program(std::string(span.raw));
+		return;
+	}
+	if (span.line.empty())
+		return;
+	if (!regex_rules.empty() && regex_rules.match(span.line, [this](const std::string &pattern, const std::vector<std::string> &captures){
+			run_regex_rule(pattern, captures);
+		})){
+		after_feed(span.key);
+		return;
+	}
+	feed_value(span.key, span_value(span.value));
+}
+
+bool Context::parse(std::string data, FeedRecord &record){
+	return parse(LineScanner::split(data.data(), data.length()), record);
+}
+
+bool Context::parse_secure(std::string data, FeedRecord &record){
+	return parse_secure(LineScanner::split(data.data(), data.length()), record);
+}
+
+any Context::span_value(std::string_view text){
+	any value;
+	if (!parse_number(text, value, units))
+		return to_any(int64_t(0));
+	return value;
+}
+
+bool Context::parse(const LineSpan &span, FeedRecord &record){
+	if (span.line.empty())
+		return false;
+	record.value=span_value(span.value);
+	record.line.assign(span.line); // Regex rules may be defined before it is applied
+	record.key.assign(span.key);
+	record.is_program=false;
+	return true;
+}
+
+bool Context::parse_secure(const LineSpan &span, FeedRecord &record){
+	if (span.raw.length()>0 && (span.raw[0]==':' || span.raw[0]=='/')){
+		record.key.assign(span.raw);
+		record.is_program=true;
+		return true;
 	}
+	return parse(span, record);
 }
 
-void Context::feed(std::string data){
-	::loglang::clean(data);
-	if (data.length()==0)
+void Context::feed(FeedRecord record){
+	if (record.is_program){
+		define_program(record.key);
 		return;
-	auto spacepos=data.find_first_of(' ');
-	auto key=data.substr(0, spacepos);
-	auto value=data.substr(spacepos+1);
+	}
+	if (!record.line.empty() && regex_rules.match(record.line, [this](const std::string &pattern, const std::vector<std::string> &captures){
+			run_regex_rule(pattern, captures);
+		})){
+		after_feed(record.key);
+		return;
+	}
+	feed_value(record.key, std::move(record.value));
+}
+
+void Context::feed_value(std::string_view key, any value){
 	if (debug){
-		std::cerr<<"Set <"<<key<<"> = <"<<value<<">"<<std::endl;
+		std::cerr<<"Set <"<<key<<"> = <"<<std::to_string(value)<<">"<<std::endl;
+	}
+	if (_tracer){ // A span for the lines that run some rule
+		auto start=ticks();
+		auto runs=programs_run();
+		auto &sym=get_value(key);
+		sym.set(std::move(value), *this);
+		after_feed(key);
+		if (programs_run()!=runs)
+			_tracer->add(Tracer::LINE, start, ticks(), &sym);
+		return;
+	}
+	get_value(key).set(std::move(value), *this);
+	after_feed(key);
+}
+
+void Context::after_feed(std::string_view key)
+{
+	if (batch_depth>0)
+		return;
+	if (!batch_window.enabled()){
+		run_scheduled();
+		return;
+	}
+	if (batch_lines++==0)
+		batch_start=std::chrono::steady_clock::now();
+	if ((!batch_window.marker.empty() && key==batch_window.marker) || (batch_window.lines>0 && batch_lines>=batch_window.lines))
+		flush();
+	else
+		flush_expired();
+}
+
+void Context::begin_batch()
+{
+	batch_depth++;
+}
+
+void Context::end_batch()
+{
+	if (batch_depth>0 && --batch_depth==0)
+		flush();
+}
+
+void Context::flush()
+{
+	batch_lines=0;
+	run_scheduled();
+}
+
+int Context::flush_expired()
+{
+	if (batch_lines==0 || batch_window.time.count()==0)
+		return -1;
+	auto elapsed=std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-batch_start);
+	if (elapsed>=batch_window.time){
+		flush();
+		return -1;
 	}
-	get_value(key).set(to_any(int64_t(to_number(value))), *this);
+	return (batch_window.time-elapsed).count();
+}
+
+void Context::run_scheduled()
+{
+	if (scheduler.needs_ranks())
+		scheduler.rank(programs);
+	if (_tracer && scheduler.pending()){
+		auto start=ticks();
+		scheduler.run(*this);
+		_tracer->add(Tracer::CASCADE, start, ticks(), nullptr);
+		return;
+	}
+	scheduler.run(*this);
 }
 
 
@@ -114,36 +373,70 @@ void Context::set_output(std::function<void (const std::string &data)> &&output)
 }
 
 
-void Context::debug_values()
+void Context::debug_values(std::function<bool (const std::string &name)> filter)
 {
 	for (auto &pair: symboltable){
-		if (pair.second.get())
-			std::cerr<<pair.first<<" = "<<std::to_string(pair.second.get())<<std::endl;
+		if (filter && !filter(pair.second->name()))
+			continue;
+		if (pair.second->get())
+			std::cerr<<pair.first<<" = "<<std::to_string(pair.second->get())<<std::endl;
 		else
 			std::cerr<<pair.first<<std::endl;
 	}
 }
 
+void Context::write_stats(std::ostream &out) const
+{
+	std::vector<const Program*> all;
+	for(auto &pair: programs)
+		all.push_back(pair.second.get());
+	for(auto &pair: regex_programs)
+		all.push_back(pair.second.get());
+	std::sort(std::begin(all), std::end(all), [](const Program *a, const Program *b){
+		return a->stats.total_ticks>b->stats.total_ticks;
+	});
+	
+	auto per_ns=ticks_per_ns();
+	out<<"{\"time\": "<<std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+		<<", \"programs_run\": "<<programs_run()<<", \"changes\": "<<_changes<<", \"programs\": [";
+	for(size_t i=0;i<all.size();i++){
+		auto &s=all[i]->stats;
+		auto &top=s.top_trigger();
+		out<<(i ? ",\n" : "\n")<<"  {\"name\": "<<json_quote(all[i]->name())
+			<<", \"triggered\": "<<s.triggered<<", \"runs\": "<<s.runs<<", \"no_change\": "<<s.no_change
+			<<", \"errors\": "<<s.errors<<", \"writes\": "<<s.writes
+			<<", \"total_ns\": "<<uint64_t(s.total_ticks/per_ns)<<", \"max_ns\": "<<uint64_t(s.max_ticks/per_ns)
+			<<", \"top_trigger\": "<<(top.symbol ? json_quote(top.symbol->name()) : std::string("null"))
+			<<", \"top_trigger_count\": "<<top.count<<"}";
+	}
+	out<<"\n]}"<<std::endl;
+}
+
 void Context::output(const std::string& str, const std::string& str2)
 {
 	output(str+" "+str2);
 }
 
-Symbol& Context::get_value(const std::string& key)
+Symbol& Context::get_value(std::string_view key)
 {
 	auto I=symboltable.find(key);
 	if (I!=std::end(symboltable))
-		return I->second;
-	auto J=symboltable.insert(std::make_pair(key,Symbol(key)));
+		return *I->second;
+	auto owned=std::make_unique<Symbol>(std::string(key));
+	auto &sym=*owned;
+	std::string_view name=sym.name();
+	symboltable.emplace(name, std::move(owned));
+	sorted_symbols.emplace(name, &sym);
 	
 	// Add new dependenies, if matches any old dependency.
-	for(auto &kv: glob_dependencies_programs){
-		if (glob_match(key, kv.first)){
-			J.first->second.run_at_modify(kv.second);
-		}
-	}
+	for(auto &prog: glob_dependencies.match(key))
+		sym.run_at_modify(prog);
+	for(auto aggregate: aggregate_index.match(key))
+		sym.add_aggregate(aggregate);
+	for(auto watcher: watcher_index.match(key))
+		sym.add_watcher(watcher);
 	
-	return J.first->second;
+	return sym;
 }
 
 any Context::fn(const std::string& fname, const std::vector<any> &vars){
@@ -154,33 +447,85 @@ any Context::fn(const std::string& fname, const std::vector<any> &vars){
 	return F->second(*this, vars);
 }
 
-any Context::get_glob_values(const std::string& glob){
-	std::vector<any> ret;
-	// Add new dependenies, if matches any old dependency.
-	for(auto &kv: symboltable){
-		if (glob_match(kv.first, glob)){
-			auto &val=kv.second.get();
-			if (val)
-				ret.push_back(val->clone());
-		}
+void Context::for_each_glob_match(const Glob &glob, std::function<void (Symbol &)> f){
+	// All matches start with the literal prefix, so only check the names from there on.
+	auto prefix=glob.literal_prefix();
+	for(auto I=sorted_symbols.lower_bound(prefix), endI=std::end(sorted_symbols); I!=endI; ++I){
+		auto name=I->first;
+		if (name.compare(0, prefix.length(), prefix)!=0)
+			break;
+		if (glob.match(name))
+			f(*I->second);
 	}
+}
+
+any Context::get_glob_values(const Glob &glob){
+	std::vector<any> ret;
+	for_each_glob_match(glob, [&ret](Symbol &sym){
+		auto &val=sym.get();
+		if (val)
+			ret.push_back(val);
+	});
 	return to_any(std::move(ret));
 }
 
 std::vector<Symbol*> Context::symboltable_filter(const std::string &glob){
 	std::vector<Symbol*> ret;
-	for(auto &kv: symboltable){
-		if (glob_match(kv.first, glob)){
-			Symbol *sym=&kv.second;
-			auto &val=sym->get();
-			if (val)
-				ret.push_back(sym);
-		}
-	}
+	for_each_glob_match(Glob(glob), [&ret](Symbol &sym){
+		if (sym.get())
+			ret.push_back(&sym);
+	});
 	return ret;
 }
 
-void Context::register_function(std::string fnname, std::function<any (Context &, const std::vector<any> &)> f)
+GlobAggregate &Context::get_aggregate(const std::string &glob){
+	auto &aggregate=aggregates[glob];
+	if (!aggregate){
+		aggregate.reset(new GlobAggregate(Glob(glob)));
+		auto ptr=aggregate.get();
+		for_each_glob_match(ptr->get_glob(), [ptr](Symbol &sym){
+			sym.add_aggregate(ptr);
+		});
+		aggregate_index.add(glob, ptr);
+	}
+	return *aggregate;
+}
+
+const watcher_t *Context::watch(const std::string &glob, watcher_t f){
+	watchers.push_back(std::unique_ptr<watcher_t>(new watcher_t(std::move(f))));
+	auto watcher=watchers.back().get();
+	if (!is_glob(glob)){
+		get_value(glob).add_watcher(watcher);
+		return watcher;
+	}
+	for_each_glob_match(Glob(glob), [watcher](Symbol &sym){
+		sym.add_watcher(watcher);
+	});
+	watcher_index.add(glob, watcher);
+	return watcher;
+}
+
+void Context::unwatch(const std::string &glob, const watcher_t *watcher){
+	if (!is_glob(glob))
+		get_value(glob).remove_watcher(watcher);
+	else{
+		for_each_glob_match(Glob(glob), [watcher](Symbol &sym){
+			sym.remove_watcher(watcher);
+		});
+		watcher_index.remove(glob, watcher);
+	}
+	watchers.erase( std::remove_if(std::begin(watchers), std::end(watchers), [watcher](const std::unique_ptr<watcher_t> &w){ return w.get()==watcher; }), std::end(watchers));
+}
+
+void Context::register_function(std::string fnname, function_t f)
 {
 	functions[std::move(fnname)]=f;
 }
+
+const function_t *Context::get_function(const std::string &fname) const
+{
+	auto F=functions.find(fname);
+	if (F==std::end(functions))
+		return nullptr;
+	return &F->second;
+}
@@ -19,35 +19,231 @@
 #include <vector>
 #include <functional>
 #include <unordered_map>
+#include <map>
+#include <chrono>
+#include <iosfwd>
 
 #include "symbol.hpp"
+#include "vm.hpp"
+#include "globindex.hpp"
+#include "glob.hpp"
+#include "aggregate.hpp"
+#include "scheduler.hpp"
+#include "regexset.hpp"
+#include "linescan.hpp"
+#include "trace.hpp"
+#include "changelog.hpp"
+#include "programcache.hpp"
 // #include "program.hpp"
 
 namespace loglang{
 	class Program;
 	
-	class Context : public std::enable_shared_from_this<Context>{
+	/**
+	 * @short When to run the rules on batched input
+	 *
+	 * Data lines are applied as they come, but rules only run when the batch ends: at the marker key
+	 * line (after setting it), after that many lines, or when the time passed since the first line.
+	 * Zero or empty disables that condition; all empty runs the rules after each line.
+	 */
+	class BatchWindow{
+	public:
+		std::string marker;
+		size_t lines=0;
+		std::chrono::milliseconds time{0};
+		
+		bool enabled() const { return !marker.empty() || lines>0 || time.count()>0; }
+	};
+	
+	/**
+	 * @short An input line already parsed, ready to be applied to the context.
+	 *
+	 * Parsing does not use the context, so it can be done at other threads.
+	 */
+	class FeedRecord{
+	public:
+		std::string key; // Full line for programs
+		any value;
+		bool is_program=false;
+		std::string line; // Full data line, for the regex rules
+	};
+	
+	/**
+	 * @short Where the FeedBox feeds the input lines.
+	 *
+	 * A Context, or a ShardedContext that partitions it among many contexts.
+	 */
+	class FeedTarget{
+	public:
+		virtual ~FeedTarget(){}
+		virtual void feed_secure(std::string_view data) = 0;
+		virtual void feed(std::string_view data) = 0;
+		/// A line already split by the LineScanner.
+		virtual void feed(const LineSpan &span, bool is_secure) = 0;
+		virtual void feed(FeedRecord record) = 0;
+		/// Runs the rules for the pending lines, if any.
+		virtual void flush() = 0;
+		/// Flushes if the time window has passed, and returns the milliseconds until it does, or -1 if no timeout pending.
+		virtual int flush_expired() = 0;
+	};
+	
+	class Context : public FeedTarget, public std::enable_shared_from_this<Context>{
 		std::function<void (const std::string &output)> _output;
-		std::unordered_map<std::string, Symbol> symboltable;
-		std::unordered_map<std::string, std::shared_ptr<Program>> glob_dependencies_programs;
+		std::unordered_map<std::string_view, std::unique_ptr<Symbol>> symboltable; // Keys are the symbol names, so any view finds them.
+		std::map<std::string_view, Symbol*> sorted_symbols; // Same as symboltable, sorted, to find glob matches by prefix.
+		GlobIndex<std::shared_ptr<Program>> glob_dependencies;
+		std::unordered_map<std::string, std::unique_ptr<GlobAggregate>> aggregates;
+		GlobIndex<GlobAggregate*> aggregate_index; // To add new symbols to the aggregates they match
+		std::vector<std::unique_ptr<watcher_t>> watchers;
+		GlobIndex<const watcher_t*> watcher_index;
 		std::unordered_map<std::string, std::shared_ptr<Program>> programs;
-		std::unordered_map<std::string, std::function<any (Context &, const std::vector<any> &)>> functions;
+		RegexSet regex_rules;
+		std::unordered_map<std::string, std::shared_ptr<Program>> regex_programs; // By pattern
+		const std::vector<std::string> *captures=nullptr; // Of the running regex rule
+		uint64_t program_sequence=0;
+		Scheduler scheduler;
+		std::unordered_map<std::string, function_t> functions;
+		Symbol *percent; // %, the symbol that triggered the running program
+		VM _vm;
+		store_log *_journal=nullptr;
+		BatchWindow batch_window;
+		int batch_depth=0; // Explicit begin_batch
+		size_t batch_lines=0; // Pending to run
+		std::chrono::steady_clock::time_point batch_start;
+		bool _muted=false;
+		uint64_t _changes=0;
+		std::unique_ptr<Tracer> _tracer;
+		std::unique_ptr<ChangeLog> _change_log;
+		ProgramCache _program_cache;
+		
+		/// By name, as `:name` or `/regex/`, or nullptr.
+		std::shared_ptr<Program> find_program(const std::string &name) const;
+		void remove_program(const std::string &name);
+		void define_program(const std::string &data);
+		void define_regex_rule(const std::string &data);
+		void run_regex_rule(const std::string &pattern, const std::vector<std::string> &captures);
+		/// Runs the rules if the batch window allows it, after applying a line.
+		void after_feed(std::string_view key);
+		/// Sets the symbol, and runs the rules if the batch window allows it.
+		void feed_value(std::string_view key, any value);
+		/// Calls f for each symbol whose name matches the glob, including undefined ones.
+		void for_each_glob_match(const Glob &glob, std::function<void (Symbol &)> f);
 	public:
 		Context();
-		void feed_secure(std::string data);
-		void feed(std::string data);
+		void feed_secure(std::string_view data) override;
+		void feed(std::string_view data) override;
+		/// Only a new symbol allocates; lines for known symbols are applied from the span.
+		void feed(const LineSpan &span, bool is_secure) override;
+		/// Parses a data line into record. Returns false if there is no data in it.
+		static bool parse(std::string data, FeedRecord &record);
+		/// Same as parse, but programs are allowed.
+		static bool parse_secure(std::string data, FeedRecord &record);
+		/// Same from a line already split by the LineScanner.
+		static bool parse(const LineSpan &span, FeedRecord &record);
+		static bool parse_secure(const LineSpan &span, FeedRecord &record);
+		/// Value of a data line.
+		static any span_value(std::string_view text);
+		/**
+		 * @short Splits a `:name code` program or `/regex/ code` rule line.
+		 *
+		 * The name of regex rules is the pattern with the slashes. Code is empty to remove it.
+		 * Returns false if it is not a valid program line.
+		 */
+		static bool split_program(const std::string &line, std::string &name, std::string &code);
+		/// Regex of a `/regex/` rule name.
+		static std::string regex_pattern(const std::string &name);
+		/// Same as feeding the line the record was parsed from.
+		void feed(FeedRecord record) override;
+		/// Runs the regex rule as if a line matched it, with those captures.
+		void feed_match(const std::string &pattern, const std::vector<std::string> &captures);
+		/// Value of the group n of the running regex rule match.
+		any capture(size_t n) const;
 		void set_output(std::function<void (const std::string &output)> &&);
-		void output(const std::string &str){ _output(str); }
+		void output(const std::string &str){ if (!_muted) _output(str); }
 		void output(const std::string &str, const std::string &str2);
-		Symbol &get_value(const std::string &key);
+		Symbol &get_value(std::string_view key);
+		Symbol &percent_symbol(){ return *percent; }
 		
 		/// Returns the resolved glob values. 
-		any get_glob_values(const std::string &glob);
+		any get_glob_values(const Glob &glob);
 		std::vector<Symbol*> symboltable_filter(const std::string &glob);
+		/// Returns the aggregate over the glob, created on first use and kept updated from then on.
+		GlobAggregate &get_aggregate(const std::string &glob);
 		
-		void register_function(std::string fnname, std::function<any (Context &, const std::vector<any> &)> f);
+		void register_function(std::string fnname, function_t f);
+		/// Returns the function, or nullptr if not known
+		const function_t *get_function(const std::string &fname) const;
 		any fn(const std::string &fname, const std::vector<any> &args);
 		
-		void debug_values();
+		/// Shows all values, or only the ones whose name passes the filter.
+		void debug_values(std::function<bool (const std::string &name)> filter=nullptr);
+		
+		void schedule(const std::shared_ptr<Program> &program, Symbol &trigger){ scheduler.schedule(program, trigger); }
+		/// Runs all the programs scheduled by the changes since last call.
+		void run_scheduled();
+		uint64_t programs_run() const { return scheduler.programs_run(); }
+		/// Symbol changes since the start; programs count their writes with it.
+		uint64_t changes() const { return _changes; }
+		void count_change(Symbol &symbol){
+			_changes++;
+			if (_tracer)
+				_tracer->write(&symbol);
+			if (_change_log && &symbol!=percent)
+				_change_log->set(symbol);
+		}
+		/// Spans of the rule cascades are kept from now on, the last that many.
+		void enable_tracing(size_t spans){ _tracer=std::make_unique<Tracer>(spans); }
+		/// Or nullptr if not tracing.
+		Tracer *tracer() const { return _tracer.get(); }
+		/**
+		 * @short Writes symbols, programs and their at and edge_if state to a binary snapshot.
+		 *
+		 * Written to a temporary file, synced and renamed, so the file is always a full
+		 * snapshot. With a change log, it moves to a new segment, and the older segments are
+		 * removed once the snapshot is written. Throws on error.
+		 */
+		void save_snapshot(const std::string &filename);
+		/**
+		 * @short Restores a snapshot, as the start after a restart.
+		 *
+		 * Programs are defined again, and the values and state are set without running them.
+		 * Programs defined later with the same source keep that state. Throws if the file is not
+		 * a valid snapshot; returns false if it does not exist. log_segment is set to the first
+		 * change log segment to replay after it.
+		 */
+		bool load_snapshot(const std::string &filename, uint64_t *log_segment=nullptr);
+		/**
+		 * @short Applies the changes at the log segments from first_segment on, as load_snapshot.
+		 *
+		 * A torn frame, as written at a crash, ends its segment. Returns the records applied.
+		 */
+		uint64_t replay_change_log(const std::string &path, uint64_t first_segment=0);
+		/// Symbol changes, definitions and program state are logged there from now on.
+		void set_change_log(std::unique_ptr<ChangeLog> log){ _change_log=std::move(log); }
+		/// Or nullptr if not logging.
+		ChangeLog *change_log() const { return _change_log.get(); }
+		/// Compiled programs by source, so defining the same text again does not parse it.
+		ProgramCache &program_cache(){ return _program_cache; }
+		/// Writes the counters of all programs as JSON, the most time consuming first.
+		void write_stats(std::ostream &out) const;
+		
+		void set_batch_window(BatchWindow window){ batch_window=std::move(window); }
+		/// Data fed until end_batch is applied, but rules run only once at end_batch. May be nested.
+		void begin_batch();
+		void end_batch();
+		void flush() override;
+		int flush_expired() override;
+		
+		/// Calls f after each change of the symbols that match the glob, including symbols created later. Returns it, to unwatch.
+		const watcher_t *watch(const std::string &glob, watcher_t f);
+		/// Stops calling a watcher that watch returned for that glob.
+		void unwatch(const std::string &glob, const watcher_t *watcher);
+		
+		VM &vm(){ return _vm; }
+		/// If set, direct stores of the running AST are logged there. Only used to check the VM.
+		store_log *journal(){ return _journal; }
+		store_log *set_journal(store_log *j){ std::swap(j, _journal); return j; }
+		/// Discards output while muted. Used for VM dry runs.
+		bool set_muted(bool m){ std::swap(m, _muted); return m; }
 	};
 };
@@ -21,12 +21,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include <iostream>
+#include <vector>
+#include <set>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 #include "feedbox.hpp"
 #include "context.hpp"
 #include "utils.hpp"
+#include "ring.hpp"
+#include "linescan.hpp"
 
 #define INOTIFY_EVENT_SIZE  ( sizeof (struct inotify_event) )
 #define INOTIFY_EVENT_BUF_LEN     ( 1024 * ( INOTIFY_EVENT_SIZE + 16 ) )
@@ -34,25 +46,122 @@
 namespace loglang{
 	extern bool debug;
 	
-	class FeedStream{
+	static const size_t backfill_min_size=1024*1024; // Smaller files are just read
+	static const size_t backfill_window=16*1024*1024; // Per thread
+	
+	/// Opens a pipe, fifo or stdin, nonblocking. Previous flags are stored to restore them on close.
+	static int open_stream(const std::string &filename, int &prev_flags){
+		int fd;
+		if (filename=="<stdin>") // special name
+			fd=0;
+		else{
+			fd=open(filename.c_str(), O_RDONLY);
+			if (fd<0){
+				throw std::ios_base::failure(std::string("Cant open ")+filename);
+			}
+		}
+		prev_flags=fcntl(fd, F_GETFL);
+		if (prev_flags<0 || fcntl(fd, F_SETFL, prev_flags | O_NONBLOCK)<0){
+			close(fd);
+			throw std::runtime_error("Bad file descriptor");
+		}
+		return fd;
+	}
+	
+	/**
+	 * @short Common part of the feeds: splits the read data into lines, parses and feeds them.
+	 *
+	 * Lines are split by the LineScanner straight from the read buffer, and fed as spans of it;
+	 * only the partial line at the end of a read is copied, to the carry. Feeds that pass lines
+	 * to other threads parse them into records instead.
+	 */
+	class LineFeed{
 	public:
 		bool is_secure;
-		int fd;
 		std::string filename;
-		FILE *file;
-
-		FeedStream(std::string filename_, bool is_secure, int epollfd) : filename(std::move(filename_)), is_secure(is_secure){
-			if (filename=="<stdin>") // special name
-				fd=0;
-			else{
-				fd=open(filename.c_str(), O_RDONLY);
-				if (fd<0){
-					throw std::ios_base::failure(std::string("Cant open ")+filename);
+		std::string carry; // Partial line at the end of read data
+		bool skipping=false; // Dropping the rest of a line longer than max_line
+		std::vector<char> buffer; // Reused for each read
+		LineScanner scanner;
+		
+		static constexpr size_t max_line=1<<20;
+		static constexpr size_t max_read=16*64*1024; // Per wake up, so a busy feed does not starve the rest
+		
+		LineFeed(std::string filename_, bool is_secure) : is_secure(is_secure), filename(std::move(filename_)), buffer(64*1024){}
+		
+		/// Calls on_line with the spans of all full lines in data; the partial last one is kept in carry until the rest arrives.
+		template<typename F>
+		void split_lines(const char *data, size_t len, F on_line){
+			size_t start=0;
+			if (!carry.empty() || skipping){
+				auto nl=(const char*)memchr(data, '\n', len);
+				if (!nl){
+					keep_partial(data, len);
+					return;
+				}
+				if (skipping)
+					skipping=false;
+				else{
+					carry.append(data, nl-data);
+					on_line(LineScanner::split(carry.data(), carry.length()));
+					carry.clear();
 				}
+				start=nl-data+1;
+			}
+			start+=scanner.scan(data+start, len-start, on_line);
+			keep_partial(data+start, len-start);
+		}
+		/// At end of data the carry is a full line.
+		template<typename F>
+		void split_carry(F on_line){
+			if (!carry.empty()){
+				on_line(LineScanner::split(carry.data(), carry.length()));
+				carry.clear();
+			}
+			skipping=false;
+		}
+		/// Forgets the partial line, as when the file is truncated or replaced.
+		void clear_carry(){
+			carry.clear();
+			skipping=false;
+		}
+		/// Appends to the carry, or drops the line if it gets longer than max_line.
+		void keep_partial(const char *data, size_t len){
+			if (skipping)
+				return;
+			if (carry.length()+len<=max_line){
+				carry.append(data, len);
+				return;
 			}
-			file=fdopen(fd,"rt");
-			if (!file)
-				throw std::runtime_error("Bad file descriptor");
+			std::cerr<<filename<<": Line longer than "<<max_line<<" bytes, dropped."<<std::endl;
+			carry.clear();
+			skipping=true;
+		}
+		bool parse_line(const LineSpan &span, FeedRecord &record) const{
+			return is_secure ? Context::parse_secure(span, record) : Context::parse(span, record);
+		}
+		void feed_lines(FeedTarget &ctx, const char *data, size_t len){
+			split_lines(data, len, [this, &ctx](const LineSpan &span){ ctx.feed(span, is_secure); });
+		}
+		void feed_carry(FeedTarget &ctx){
+			split_carry([this, &ctx](const LineSpan &span){ ctx.feed(span, is_secure); });
+		}
+	};
+	
+	/**
+	 * @short A pipe, fifo or stdin.
+	 *
+	 * Nonblocking; on each wake up the available data is read in big chunks, up to max_read, and
+	 * all the lines in it are fed before going back to epoll. The rest wakes it up again, after
+	 * the other feeds.
+	 */
+	class FeedStream : public LineFeed{
+	public:
+		int fd;
+		int prev_flags; // To restore them, as stdin may be shared with other processes.
+
+		FeedStream(std::string filename_, bool is_secure, int epollfd) : LineFeed(std::move(filename_), is_secure){
+			fd=open_stream(filename, prev_flags);
 			
 			struct epoll_event ev;
 			memset(&ev, 0, sizeof(ev));
@@ -60,7 +169,7 @@ namespace loglang{
 			ev.data.fd=fd;
 			
 			if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0){
-				fclose(file);
+				fcntl(fd, F_SETFL, prev_flags);
 				close(fd);
 				throw std::runtime_error(std::string("Could not add poll descriptor: ")+strerror(errno));
 			}
@@ -71,29 +180,175 @@ namespace loglang{
 		FeedStream &operator=(FeedStream &&) = delete;
 		~FeedStream(){
 			if (fd>=0){
-				fclose(file);
+				fcntl(fd, F_SETFL, prev_flags);
 				close(fd);
 			}
 		}
+		
+		/// Reads and feeds the available data, up to max_read. Returns false at end of file.
+		bool read_available(FeedTarget &ctx){
+			size_t total=0;
+			while (total<max_read){
+				ssize_t len=read(fd, buffer.data(), buffer.size());
+				if (len>0){
+					feed_lines(ctx, buffer.data(), len);
+					total+=len;
+					continue;
+				}
+				if (len==0){
+					feed_carry(ctx);
+					return false;
+				}
+				if (errno==EAGAIN || errno==EWOULDBLOCK)
+					return true;
+				if (errno!=EINTR)
+					throw std::runtime_error(filename+": Error reading data: "+std::string(strerror(errno)));
+			}
+			return true;
+		}
 	};
-	class FeedFile{
+	/**
+	 * @short A pipe, fifo or stdin read and parsed at its own thread.
+	 *
+	 * Parsed records are passed to the evaluation thread in order by a SPSCRing, and the wake up
+	 * descriptor (an eventfd polled by the FeedBox) is written after each read. If the ring is full
+	 * the reader waits, so a slow evaluation slows down the reader instead of using more memory.
+	 */
+	class FeedThread : public LineFeed{
 	public:
-		bool is_secure;
-		int wd; // inotify wait descriptor
-		std::string filename;
-		int lineno; // Last read line, to skip there. 
-		char *line;
-		size_t line_size;
+		int fd;
+		int prev_flags;
+		int wakefd;
+		SPSCRing<FeedRecord> ring;
+		std::atomic<bool> stop{false};
+		std::atomic<bool> done{false}; // No more records will be pushed
+		std::string error; // Set before done
+		bool pending=false; // Last drain left records at the ring
+		std::thread thread;
 		
-		FeedFile(std::string filename_, bool is_secure, int inotifyfd, Context &ctx) : filename(std::move(filename_)), is_secure(is_secure){
-			wd = inotify_add_watch( inotifyfd, filename.c_str(), IN_MODIFY | IN_CREATE );
-			if (wd<0){
-				throw std::runtime_error(std::string("Could not inotify this file: ")+filename);
+		FeedThread(std::string filename_, bool is_secure, size_t ring_size, int wakefd) : LineFeed(std::move(filename_), is_secure), wakefd(wakefd), ring(ring_size){
+			fd=open_stream(filename, prev_flags);
+			thread=std::thread([this](){ read_loop(); });
+		}
+		FeedThread(FeedThread &) = delete;
+		FeedThread &operator=(FeedThread &) = delete;
+		FeedThread(FeedThread &&) = delete;
+		FeedThread &operator=(FeedThread &&) = delete;
+		~FeedThread(){
+			stop=true;
+			if (thread.joinable())
+				thread.join();
+			fcntl(fd, F_SETFL, prev_flags);
+			close(fd);
+		}
+		
+		/**
+		 * @short Evaluation thread side: feeds the ready records, up to one ring's worth. Returns false when all data was fed.
+		 *
+		 * Sets pending if it stopped with records left, as the reader does not wake up again for them.
+		 */
+		bool drain(FeedTarget &ctx){
+			bool finished=done.load(std::memory_order_acquire); // Before popping, to not miss the last records
+			FeedRecord record;
+			size_t count=0;
+			pending=false;
+			while (ring.pop(record)){
+				ctx.feed(std::move(record));
+				if (++count==ring.capacity()){
+					pending=true;
+					return true;
+				}
+			}
+			return !finished;
+		}
+		
+	private:
+		void read_loop(){
+			try{
+				struct pollfd pfd;
+				pfd.fd=fd;
+				pfd.events=POLLIN;
+				while (!stop){
+					int n=poll(&pfd, 1, 100); // Timeout to check stop
+					if (n<0 && errno!=EINTR)
+						throw std::runtime_error(filename+": Error polling: "+std::string(strerror(errno)));
+					if (n<=0)
+						continue;
+					bool more=read_available();
+					wake();
+					if (!more)
+						break;
+				}
+			}
+			catch(const std::exception &e){
+				error=e.what();
+			}
+			done.store(true, std::memory_order_release);
+			wake();
+		}
+		/// Reads and pushes the available data, up to max_read, so the evaluation thread is woken often. Returns false at end of file.
+		bool read_available(){
+			size_t total=0;
+			while (!stop && total<max_read){
+				ssize_t len=read(fd, buffer.data(), buffer.size());
+				if (len>0){
+					split_lines(buffer.data(), len, [this](const LineSpan &span){ push_line(span); });
+					total+=len;
+					continue;
+				}
+				if (len==0){
+					split_carry([this](const LineSpan &span){ push_line(span); });
+					return false;
+				}
+				if (errno==EAGAIN || errno==EWOULDBLOCK)
+					return true;
+				if (errno!=EINTR)
+					throw std::runtime_error(filename+": Error reading data: "+std::string(strerror(errno)));
+			}
+			return !stop;
+		}
+		void push_line(const LineSpan &span){
+			FeedRecord record;
+			if (!parse_line(span, record))
+				return;
+			while (!ring.push(record)){
+				wake(); // Evaluation may be sleeping, with the ring full
+				if (stop)
+					return;
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
 			}
-			lineno=0;
-			line=(char*)malloc(1024);
-			line_size=1024;
-			feed_full_file(ctx);
+		}
+		void wake(){
+			uint64_t one=1;
+			if (write(wakefd, &one, sizeof(one))<0 && errno!=EAGAIN)
+				perror("wake");
+		}
+	};
+
+	/**
+	 * @short A file that is read to the end, and then followed as it grows (tail -F like).
+	 *
+	 * Keeps the file open and the byte offset of the read data, so on changes only the new bytes
+	 * are read. Partial last lines are kept until the rest is written. If the file is shorter than
+	 * the offset, it was truncated and is read again from the start; if the path is a new inode, it
+	 * was rotated: the old file is read to the end, and the new one from the start.
+	 */
+	class FeedFile : public LineFeed{
+	public:
+		int wd=-1; // inotify wait descriptor
+		int fd=-1;
+		ino_t inode=0;
+		off_t offset=0; // Of the data already read
+		bool reopen_pending=false; // Rotated, but the new file does not exist yet
+		
+		FeedFile(std::string filename_, bool is_secure, int inotifyfd, FeedTarget &ctx, unsigned backfill_threads) : LineFeed(std::move(filename_), is_secure){
+			if (!open_file(inotifyfd))
+				throw std::runtime_error(std::string("Cant open ")+filename);
+			struct stat st;
+			if (backfill_threads>1 && fstat(fd, &st)==0 && size_t(st.st_size)>=backfill_min_size)
+				backfill(ctx, backfill_threads, st.st_size);
+			else
+				read_new(ctx, true); // On first read, a last line without \n is a full line
 			if (debug){
 				std::cerr<<"Inotify open for fd "<<wd<<std::endl;
 			}
@@ -103,50 +358,163 @@ namespace loglang{
 		FeedFile(FeedFile &&) = delete;
 		FeedFile &operator=(FeedFile &&) = delete;
 		~FeedFile(){
-			free(line);
+			if (fd>=0)
+				close(fd);
 		}
-
-		void feed_full_file(Context &ctx){
-			FILE *file=fopen(filename.c_str(), "r");
+		
+		/// Opens (again) the file at filename, and watches it. Returns false if it does not exist.
+		bool open_file(int inotifyfd){
+			int nfd=open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+			if (nfd<0)
+				return false;
+			struct stat st;
+			if (fstat(nfd, &st)<0){
+				close(nfd);
+				return false;
+			}
+			if (fd>=0)
+				close(fd);
+			fd=nfd;
+			inode=st.st_ino;
+			offset=0;
+			clear_carry();
+			wd = inotify_add_watch( inotifyfd, filename.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF );
+			if (wd<0){
+				throw std::runtime_error(std::string("Could not inotify this file: ")+filename);
+			}
+			return true;
+		}
+		
+		/// Checks for truncation and rotation, and feeds the new data.
+		void update(FeedTarget &ctx, int inotifyfd){
+			struct stat st;
+			if (fstat(fd, &st)==0 && st.st_size<offset){
+				if (debug){
+					std::clog<<"File truncated: "<<filename<<std::endl;
+				}
+				offset=0;
+				clear_carry();
+			}
+			read_new(ctx, false);
+			
+			if (stat(filename.c_str(), &st)==0 && st.st_ino==inode){
+				reopen_pending=false;
+				return;
+			}
+			if (!reopen_pending){
+				if (debug){
+					std::clog<<"File rotated: "<<filename<<std::endl;
+				}
+				inotify_rm_watch(inotifyfd, wd); // May be already removed by the kernel; no problem.
+			}
+			if (!open_file(inotifyfd)){
+				reopen_pending=true;
+				return;
+			}
+			reopen_pending=false;
+			read_new(ctx, false);
+		}
+		
+		/**
+		 * @short Reads the first size bytes of the file on many threads.
+		 *
+		 * The file is mmapped and split in line aligned chunks, one per thread, which are parsed
+		 * in parallel and then fed in order, so the result is the same as reading it line by line.
+		 * Done by windows, to keep the memory for parsed records bounded.
+		 */
+		void backfill(FeedTarget &ctx, unsigned nthreads, size_t size){
+			auto map=(const char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map==MAP_FAILED){
+				read_new(ctx, true);
+				return;
+			}
+			madvise((void*)map, size, MADV_SEQUENTIAL);
+			if (debug){
+				std::cerr<<"Backfill "<<filename<<", "<<size<<" bytes on "<<nthreads<<" threads"<<std::endl;
+			}
 			
+			std::vector<std::vector<FeedRecord>> records(nthreads);
+			std::vector<std::exception_ptr> errors(nthreads);
+			size_t pos=0;
 			try{
-				int current_line=0;
-				while (!feof(file)){
-					ssize_t len=getline(&line, &line_size, file);
-					current_line++;
-					if (current_line>=lineno){
-						if (len>=0){
-							line[len-1]=0; // Remove \n
-							if (is_secure)
-								ctx.feed_secure(line);
-							else
-								ctx.feed(line);
-						}
+				while (pos<size){
+					auto end=line_start(map, size, std::min(size, pos+backfill_window*nthreads));
+					std::vector<size_t> bounds{pos};
+					for(unsigned i=1;i<nthreads;i++)
+						bounds.push_back(std::max(bounds.back(), line_start(map, size, pos+(end-pos)*i/nthreads)));
+					bounds.push_back(end);
+					
+					std::vector<std::thread> threads;
+					for(unsigned i=0;i<nthreads;i++){
+						threads.emplace_back([&, i](){
+							try{
+								parse_chunk(map+bounds[i], map+bounds[i+1], records[i]);
+							}
+							catch(...){
+								errors[i]=std::current_exception();
+							}
+						});
 					}
-				}
-				if (current_line<lineno){ // If lineno is greater, then truncated file
-					if (debug){
-						std::clog<<"File truncated: "<<filename<<std::endl;
+					for(auto &th: threads)
+						th.join();
+					for(unsigned i=0;i<nthreads;i++){
+						if (errors[i])
+							std::rethrow_exception(errors[i]);
+						for(auto &record: records[i])
+							ctx.feed(std::move(record));
+						records[i].clear();
 					}
-					lineno=0;
-					feed_full_file(ctx); // Read from start
-				}
-				else{
-					lineno=current_line; 
+					pos=end;
 				}
 			}
 			catch(...){
-				fclose(file);
+				munmap((void*)map, size);
 				throw;
 			}
-			fclose(file);
+			munmap((void*)map, size);
+			offset=size;
+		}
+		
+		/// Start of the first line at pos or after it
+		static size_t line_start(const char *data, size_t size, size_t pos){
+			if (pos==0 || pos>=size || data[pos-1]=='\n')
+				return std::min(pos, size);
+			auto nl=(const char*)memchr(data+pos, '\n', size-pos);
+			return nl ? (nl-data)+1 : size;
+		}
+		
+		/// Parses all the lines in the chunk; the last one may have no \n. Called at many threads at once.
+		void parse_chunk(const char *begin, const char *end, std::vector<FeedRecord> &out) const{
+			LineScanner chunk_scanner;
+			FeedRecord record;
+			auto on_line=[this, &out, &record](const LineSpan &span){
+				if (parse_line(span, record))
+					out.push_back(std::move(record));
+			};
+			size_t len=end-begin;
+			auto used=chunk_scanner.scan(begin, len, on_line);
+			if (used<len)
+				on_line(LineScanner::split(begin+used, len-used));
+		}
+		
+		/// Reads from offset to the end of file, and feeds the full lines.
+		void read_new(FeedTarget &ctx, bool last_line_complete){
+			ssize_t len;
+			while ( (len=pread(fd, buffer.data(), buffer.size(), offset))>0 ){
+				offset+=len;
+				feed_lines(ctx, buffer.data(), len);
+			}
+			if (len<0)
+				throw std::runtime_error(filename+": Error reading data: "+std::string(strerror(errno)));
+			if (last_line_complete)
+				feed_carry(ctx);
 		}
 	};
 }
 
 using namespace loglang;
 
-FeedBox::FeedBox(std::shared_ptr<Context> ctx) : ctx(ctx), rline(nullptr), inotify_buffer(nullptr)
+FeedBox::FeedBox(std::shared_ptr<FeedTarget> ctx) : ctx(ctx), inotify_buffer(nullptr), backfill_threads(std::thread::hardware_concurrency()), ring_size(0)
 {
 	pollfd=epoll_create(8);
 	if (pollfd<0){
@@ -169,19 +537,28 @@ FeedBox::FeedBox(std::shared_ptr<Context> ctx) : ctx(ctx), rline(nullptr), inoti
 		throw std::runtime_error("Could not poll on inotify descriptor.");
 	}
 	
+	wakefd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ev.data.fd=wakefd;
+	if (wakefd<0 || epoll_ctl(pollfd, EPOLL_CTL_ADD, wakefd, &ev) < 0){
+		close(pollfd);
+		close(inotifyfd);
+		if (wakefd>=0)
+			close(wakefd);
+		throw std::runtime_error("Could not create wake up descriptor.");
+	}
+	
 	inotify_buffer=(char*)malloc(INOTIFY_EVENT_BUF_LEN);
-	rline=(char*)malloc(1024); // Must be malloc, as internally getline will use realloc
-	rline_size=1024;
 }
 
 FeedBox::~FeedBox()
 {	
 	if (pollfd>=0)
 		close(pollfd);
+	threadfeeds.clear(); // Stops the threads
 	if (inotifyfd>=0)
 		close(inotifyfd);
-	if (rline)
-		free(rline);
+	if (wakefd>=0)
+		close(wakefd);
 	if (inotify_buffer)
 		free(inotify_buffer);
 }
@@ -191,23 +568,18 @@ FeedBox::~FeedBox()
  */
 void FeedBox::add_feed(std::string filename, bool is_secure)
 {
-	if (filename=="<stdin>"){
-		auto feed=std::make_shared<FeedStream>(std::move(filename), is_secure, pollfd);
-		feeds.insert(std::make_pair(feed->fd,std::move(feed)));
+	struct stat st;
+	if (filename=="<stdin>" || (stat(filename.c_str(), &st)>=0 && S_ISFIFO(st.st_mode))){
+		if (ring_size>0)
+			threadfeeds.push_back(std::make_shared<FeedThread>(std::move(filename), is_secure, ring_size, wakefd));
+		else{
+			auto feed=std::make_shared<FeedStream>(std::move(filename), is_secure, pollfd);
+			feeds.insert(std::make_pair(feed->fd,std::move(feed)));
+		}
 		++epoll_files;
 	}
 	else{
-		struct stat st;
-		if (stat(filename.c_str(), &st)>=0){ // If its a FIFO
-			if (S_ISFIFO(st.st_mode)){
-				auto feed=std::make_shared<FeedStream>(std::move(filename), is_secure, pollfd);
-				feeds.insert(std::make_pair(feed->fd,std::move(feed)));
-				++epoll_files;
-				return;
-			}
-		}
-		
-		auto feed=std::make_shared<FeedFile>(std::move(filename), is_secure, inotifyfd, *ctx);
+		auto feed=std::make_shared<FeedFile>(std::move(filename), is_secure, inotifyfd, *ctx, backfill_threads);
 		filefeeds.insert(std::make_pair(feed->wd,std::move(feed)));
 	}
 }
@@ -231,8 +603,22 @@ void FeedBox::run_once(){
 		running=false;
 		return;
 	}
-	int nfds = epoll_wait(pollfd, events, 8, -1);
-	std::string line;
+	// Wakes up at batch timeout, and each second while some rotated file is not there yet.
+	int timeout=ctx->flush_expired();
+	if (!pending_files.empty() && (timeout<0 || timeout>1000))
+		timeout=1000;
+	if (periodic){
+		auto next=periodic();
+		if (next>=0 && (timeout<0 || next<timeout))
+			timeout=next;
+	}
+	if (threads_pending)
+		timeout=0;
+	int nfds = epoll_wait(pollfd, events, 8, timeout);
+	if (threads_pending)
+		drain_threads();
+	for(auto feed: std::vector<std::shared_ptr<FeedFile>>(std::begin(pending_files), std::end(pending_files)))
+		update_file(feed);
 	
 	for(int n = 0; n < nfds; ++n) {
 		if (debug){
@@ -244,38 +630,74 @@ void FeedBox::run_once(){
 				perror( "read" );
 				continue;
 			}
+			// Many events for the same file are read at once
+			std::set<int> wds;
 			int i=0;
 			while (i<length){
 				struct inotify_event *event = ( struct inotify_event * ) &inotify_buffer[ i ];
-				auto feed=filefeeds[event->wd];
-				feed->feed_full_file(*ctx);
-				
+				wds.insert(event->wd);
 				i+=INOTIFY_EVENT_SIZE+event->len;
 			}
+			for(auto wd: wds){
+				auto I=filefeeds.find(wd);
+				if (I!=std::end(filefeeds)) // Else removed watch
+					update_file(I->second);
+			}
+		}
+		else if (events[n].data.fd==wakefd){
+			uint64_t count;
+			if (read(wakefd, &count, sizeof(count))<0 && errno!=EAGAIN)
+				perror("read");
+			drain_threads();
 		}
 		else{
 			auto feed=feeds[events[n].data.fd];
-			
-			int len=getline(&rline, &rline_size, feed->file);
-			if (len<0){
-				if (!feof(feed->file))
-					throw std::runtime_error(feed->filename+": Error reading data: "+std::to_string(len)+":"+std::string(strerror(errno)));
-					
+			if (!feed->read_available(*ctx)){
 				std::cerr<<feed->filename<<": File closed."<<std::endl;
 				remove_feed(feed->fd);
 				--epoll_files;
-				continue;
+				ctx->flush(); // Rules for the last lines, even if batch not complete
 			}
-			if (len>0){
-				line=std::string(rline, len-1);
+		}
+	}
+	ctx->flush_expired();
+}
 
-				if (feed->is_secure)
-					ctx->feed_secure(line);
-				else
-					ctx->feed(line);
-			}
+void FeedBox::drain_threads()
+{
+	threads_pending=false;
+	for(auto I=std::begin(threadfeeds); I!=std::end(threadfeeds); ){
+		auto feed=*I;
+		if (feed->drain(*ctx)){
+			threads_pending=threads_pending || feed->pending;
+			++I;
+			continue;
+		}
+		if (!feed->error.empty())
+			std::cerr<<feed->error<<std::endl;
+		std::cerr<<feed->filename<<": File closed."<<std::endl;
+		if (debug){
+			std::cerr<<feed->filename<<": ring "<<feed->ring.pushed()<<" records, max occupancy "<<feed->ring.max_occupancy()
+				<<" of "<<feed->ring.capacity()<<", full "<<feed->ring.full_count()<<" times"<<std::endl;
 		}
+		I=threadfeeds.erase(I);
+		--epoll_files;
+		ctx->flush(); // Rules for the last lines, even if batch not complete
+	}
+}
+
+void FeedBox::update_file(std::shared_ptr<FeedFile> feed)
+{
+	auto wd=feed->wd;
+	feed->update(*ctx, inotifyfd);
+	if (feed->wd!=wd){ // Reopened
+		filefeeds.erase(wd);
+		filefeeds[feed->wd]=feed;
 	}
+	if (feed->reopen_pending)
+		pending_files.insert(feed);
+	else
+		pending_files.erase(feed);
 }
 
 void FeedBox::stop()
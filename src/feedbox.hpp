@@ -17,7 +17,10 @@
 #pragma once
 
 #include <map>
+#include <functional>
 #include <memory>
+#include <set>
+#include <vector>
 
 namespace loglang{
 	/**
@@ -33,22 +36,31 @@ namespace loglang{
 	*/
 	class FeedStream;
 	class FeedFile;
-	class Context;
+	class FeedThread;
+	class FeedTarget;
 	
 	class FeedBox{
 		std::map<int, std::shared_ptr<FeedStream>> feeds; // Pipe feeds, as stdin, or a fifo.
 		std::map<int, std::shared_ptr<FeedFile>> filefeeds; // File feeds, checks for changes, reload it all or from new data (tail -f like).
+		std::set<std::shared_ptr<FeedFile>> pending_files; // Rotated, waiting for the new file
+		std::vector<std::shared_ptr<FeedThread>> threadfeeds; // Pipe feeds read at their own thread, if pipelined
 		int wd; // inotify descriptor
 		int pollfd;
 		int inotifyfd;
+		int wakefd; // Written by feed threads when there are records ready
+		bool threads_pending=false; // Some ring was not fully drained, drain again at the next loop
 		bool running;
-		char *rline; // Temporal storage for line
-		size_t rline_size;
 		size_t epoll_files=0; // Count of epoll files, need at least one, stdin.
-		std::shared_ptr<Context> ctx;
+		std::shared_ptr<FeedTarget> ctx;
 		char* inotify_buffer; // Temporal buffer where inotify data is read.
+		unsigned backfill_threads; // To read big files when added
+		size_t ring_size; // Pipelined if not 0
+		std::function<int ()> periodic;
+		
+		void update_file(std::shared_ptr<FeedFile> feed);
+		void drain_threads();
 	public:
-		FeedBox(std::shared_ptr<Context> ctx);
+		FeedBox(std::shared_ptr<FeedTarget> ctx);
 		~FeedBox();
 		FeedBox() = delete;
 		FeedBox(FeedBox &) = delete;
@@ -57,6 +69,21 @@ namespace loglang{
 		FeedBox &&operator=(FeedBox &&) =delete;
 		
 		void add_feed(std::string filename, bool is_secure);
+		/// Threads to parse the existing data of big files when added. 1 or less reads them on this thread.
+		void set_backfill_threads(unsigned n){ backfill_threads=n; }
+		/**
+		 * @short Pipe feeds added from now on are read and parsed at their own thread.
+		 *
+		 * Records are passed in rings of that size to the thread that calls run, which only
+		 * evaluates the rules. 0 reads them at the run thread.
+		 */
+		void set_pipeline(size_t ring_size_){ ring_size=ring_size_; }
+		/**
+		 * @short Called at each wake up, at the rules thread, as to dump stats.
+		 *
+		 * Returns the milliseconds until it must be called again, or -1. Signals also wake up.
+		 */
+		void set_periodic(std::function<int ()> f){ periodic=std::move(f); }
 		void remove_feed(int fd);
 		
 		void run();
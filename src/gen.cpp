@@ -0,0 +1,217 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <signal.h>
+
+namespace{
+	/**
+	 * @short Settings of the generated stream.
+	 *
+	 * Each frame is a line per sent key and then `timestamp N`. Of the keys, update_ratio are sent
+	 * each frame, and of those change_ratio have a new value; the rest repeat the last one, as
+	 * the monitors do.
+	 */
+	class Options{
+	public:
+		size_t keys=1000;
+		double update_ratio=1.0;
+		double change_ratio=0.3;
+		double rules_ratio=0.0;
+		size_t rules=100; // Distinct rule names, so redefinitions replace them
+		double rate=0; // Lines per second, 0 as fast as possible
+		uint64_t frames=0; // 0 forever
+		uint32_t seed=42;
+		std::string output;
+	};
+
+	class Metric{
+	public:
+		std::string name;
+		int64_t value;
+		int64_t step; // Max change per frame
+		bool counter; // Only grows, as jiffies and sectors
+	};
+
+	/// Keys as the monitors send them: cpu.cpuN.*, disk.sdX.*, net.ethN.* and mem.*.
+	std::vector<Metric> make_metrics(size_t count, std::mt19937 &rng){
+		std::vector<Metric> metrics;
+		const char *cpu_fields[]={"user", "nice", "system", "idle", "iowait"};
+		const char *io_fields[]={"read", "write"};
+		for(auto name: {"mem.free", "mem.cached", "mem.total"})
+			metrics.push_back(Metric{name, int64_t(rng()%(1<<24)), 4096, false});
+
+		// Half the keys for cpus, and a quarter each for disks and nets.
+		size_t cpus=std::max<size_t>(1, count/2/5);
+		size_t disks=std::max<size_t>(1, count/4/2);
+		size_t nets=std::max<size_t>(1, count/4/2);
+		for(size_t i=0;i<cpus;i++)
+			for(auto field: cpu_fields)
+				metrics.push_back(Metric{"cpu.cpu"+std::to_string(i)+"."+field, int64_t(rng()%100000), 100, true});
+		for(size_t i=0;i<disks;i++){
+			std::string dev="sd";
+			for(size_t n=i;;n=n/26-1){ // sda..sdz, sdaa..
+				dev.insert(2, 1, char('a'+n%26));
+				if (n<26)
+					break;
+			}
+			for(auto field: io_fields)
+				metrics.push_back(Metric{"disk."+dev+"."+field, int64_t(rng()%1000000), 2048, true});
+		}
+		for(size_t i=0;i<nets;i++)
+			for(auto field: io_fields)
+				metrics.push_back(Metric{"net.eth"+std::to_string(i)+"."+field, int64_t(rng()%1000000), 100000, true});
+		return metrics;
+	}
+
+	/// A rule over the generated keys, so the stream also defines programs.
+	std::string make_rule(size_t n, const std::vector<Metric> &metrics, std::mt19937 &rng){
+		const char *globs[]={"cpu.cpu*.idle", "disk.*.read", "disk.*.write", "net.*.read", "net.*.write"};
+		auto &metric=metrics[rng()%metrics.size()];
+		auto id=std::to_string(n);
+		switch(n%3){
+			case 0:
+				return ":gen.rule."+id+" at timestamp do gen.sum."+id+" = sum( "+globs[rng()%5]+" )";
+			case 1:
+				return ":gen.rule."+id+" gen.double."+id+" = "+metric.name+" * 2";
+			default:
+				return ":gen.rule."+id+" edge_if "+metric.name+" > "+std::to_string(metric.value)+" then gen.alert."+id+" = 1 else gen.alert."+id+" = 0";
+		}
+	}
+
+	void usage(const char *argv0){
+		std::cerr<<"Usage: "<<argv0<<" [options]\n"
+			"  --keys n            Metric keys, default 1000.\n"
+			"  --update-ratio r    Share of the keys sent each frame, default 1.\n"
+			"  --change-ratio r    Share of the sent keys with a new value, default 0.3.\n"
+			"  --rules-ratio r     Share of the lines that define rules, default 0.\n"
+			"  --rules n           Distinct rule names, default 100.\n"
+			"  --rate n            Lines per second, default as fast as possible.\n"
+			"  --frames n          Frames to write, default forever.\n"
+			"  --seed n            Random seed, default 42.\n"
+			"  -o path             Write to the file or FIFO instead of stdout.\n";
+	}
+}
+
+int main(int argc, char **argv){
+	Options opts;
+	for(int i=1;i<argc;i++){
+		std::string arg=argv[i];
+		if (i+1>=argc){
+			usage(argv[0]);
+			return 1;
+		}
+		if (arg=="--keys")
+			opts.keys=atoll(argv[++i]);
+		else if (arg=="--update-ratio")
+			opts.update_ratio=atof(argv[++i]);
+		else if (arg=="--change-ratio")
+			opts.change_ratio=atof(argv[++i]);
+		else if (arg=="--rules-ratio")
+			opts.rules_ratio=atof(argv[++i]);
+		else if (arg=="--rules")
+			opts.rules=std::max(1ll, atoll(argv[++i]));
+		else if (arg=="--rate")
+			opts.rate=atof(argv[++i]);
+		else if (arg=="--frames")
+			opts.frames=atoll(argv[++i]);
+		else if (arg=="--seed")
+			opts.seed=atoll(argv[++i]);
+		else if (arg=="-o")
+			opts.output=argv[++i];
+		else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN); // A closed reader is a write error, and then we end.
+	FILE *out=stdout;
+	if (!opts.output.empty()){
+		out=fopen(opts.output.c_str(), "w"); // Waits for the reader if a FIFO
+		if (!out){
+			perror(opts.output.c_str());
+			return 1;
+		}
+	}
+
+	std::mt19937 rng(opts.seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	auto metrics=make_metrics(opts.keys, rng);
+	std::cerr<<"Generating "<<metrics.size()<<" keys"<<std::endl;
+
+	using clock=std::chrono::steady_clock;
+	auto start=clock::now();
+	uint64_t lines=0;
+	int64_t timestamp=1400000000;
+	size_t next_rule=0;
+	std::string buffer;
+	bool ok=true;
+	/// Writes the buffer and, with a rate, waits until those lines are due.
+	auto write_buffer=[&](){
+		if (fwrite(buffer.data(), 1, buffer.size(), out)!=buffer.size())
+			ok=false;
+		buffer.clear();
+		if (opts.rate>0){
+			fflush(out);
+			std::this_thread::sleep_until(start+std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(lines/opts.rate)));
+		}
+	};
+	auto emit=[&](const std::string &line){
+		buffer+=line;
+		buffer+='\n';
+		lines++;
+		if (uniform(rng)<opts.rules_ratio){
+			buffer+=make_rule(next_rule++%opts.rules, metrics, rng);
+			buffer+='\n';
+			lines++;
+		}
+		if (opts.rate>0 ? buffer.size()>=1024 : buffer.size()>=(1<<16)) // Small writes to keep the pace smooth
+			write_buffer();
+	};
+	for(uint64_t frame=0; ok && (opts.frames==0 || frame<opts.frames); frame++){
+		for(auto &m: metrics){
+			if (opts.update_ratio<1.0 && uniform(rng)>=opts.update_ratio)
+				continue;
+			if (uniform(rng)<opts.change_ratio){
+				auto delta=int64_t(rng()%(m.step+1));
+				if (!m.counter && rng()%2)
+					delta=-std::min(delta, m.value);
+				m.value+=delta;
+			}
+			emit(m.name+" "+std::to_string(m.value));
+		}
+		emit("timestamp "+std::to_string(timestamp++));
+	}
+	if (ok)
+		write_buffer();
+	fflush(out);
+
+	auto seconds=std::chrono::duration<double>(clock::now()-start).count();
+	std::cerr<<lines<<" lines in "<<seconds<<" s, "<<uint64_t(lines/std::max(seconds, 1e-9))<<" lines/s"<<std::endl;
+	if (out!=stdout)
+		fclose(out);
+	return 0;
+}
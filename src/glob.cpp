@@ -4,9 +4,9 @@
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  *     http://www.apache.org/licenses/LICENSE-2.0
- * 
+ *
  * Unless required by applicable law or agreed to in writing, software
  * distributed under the License is distributed on an "AS IS" BASIS,
  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
@@ -19,32 +19,103 @@
 
 using namespace loglang;
 
-bool loglang::glob_match(const std::string &text, const std::string &glob){
-	auto T=std::begin(text), endT=std::end(text);
-	auto G=std::begin(glob), endG=std::end(glob);
-	
-// 	std::cerr<<text<<" "<<glob<<std::endl;
-	while( T!=endT && G!=endG ){
-		if (*G == '?'){
-			++G; ++T;
-		}
-		else if (*G == '*'){
-			++G;
-			if (G==endG) // Easy * at end
-				return true;
-			// From here, up to end, check all posibilities.
-			for(;T!=endT;++T)
-				if (glob_match(std::string(T,endT), std::string(G, endG)))
-					return true;
+/// Text starts with chunk, with ? matching any char. Text must be at least as long as chunk.
+static bool chunk_equal(const char *text, std::string_view chunk){
+	for(size_t i=0;i<chunk.length();i++)
+		if (chunk[i]!='?' && chunk[i]!=text[i])
+			return false;
+	return true;
+}
+
+/// Position of the first chunk match in text from pos on, or npos.
+static size_t chunk_find(std::string_view text, size_t pos, std::string_view chunk, bool has_any){
+	if (!has_any)
+		return text.find(chunk, pos);
+	if (text.length()<chunk.length())
+		return std::string_view::npos;
+	for(size_t end=text.length()-chunk.length(); pos<=end; ++pos)
+		if (chunk_equal(text.data()+pos, chunk))
+			return pos;
+	return std::string_view::npos;
+}
+
+bool loglang::glob_match(std::string_view text, std::string_view glob){
+	auto first_star=glob.find('*');
+	if (first_star==std::string_view::npos)
+		return text.length()==glob.length() && chunk_equal(text.data(), glob);
+
+	auto last_star=glob.rfind('*');
+	auto first=glob.substr(0, first_star), last=glob.substr(last_star+1);
+	if (text.length() < first.length()+last.length())
+		return false;
+	if (!chunk_equal(text.data(), first) || !chunk_equal(text.data()+text.length()-last.length(), last))
+		return false;
+
+	auto middle=text.substr(0, text.length()-last.length());
+	size_t pos=first.length();
+	for(size_t g=first_star+1; g<last_star; ){
+		auto next=glob.find('*', g);
+		auto chunk=glob.substr(g, next-g);
+		g=next+1;
+		if (chunk.empty())
+			continue;
+		pos=chunk_find(middle, pos, chunk, chunk.find('?')!=std::string_view::npos);
+		if (pos==std::string_view::npos)
 			return false;
-		}
-		else if (*G == *T){
-			++G; ++T;
-		}
-		else
+		pos+=chunk.length();
+	}
+	return !last.empty() || pos<text.length(); // Trailing * needs at least one char
+}
+
+bool loglang::is_glob(std::string_view str){
+	return str.find_first_of("*?")!=std::string_view::npos;
+}
+
+std::string_view loglang::glob_literal_prefix(std::string_view glob){
+	return glob.substr(0, glob.find_first_of("*?"));
+}
+
+Glob::Glob(std::string glob) : _str(std::move(glob))
+{
+	prefix_length=glob_literal_prefix(_str).length();
+	min_length=0;
+	size_t start=0;
+	while (true){
+		auto star=_str.find('*', start);
+		auto end=(star==std::string::npos) ? _str.length() : star;
+		Chunk c{ uint32_t(start), uint32_t(end-start), false };
+		c.has_any=chunk(c).find('?')!=std::string_view::npos;
+		chunks.push_back(c);
+		min_length+=c.length;
+		if (star==std::string::npos)
+			break;
+		start=star+1;
+	}
+}
+
+bool Glob::match(std::string_view text) const
+{
+	if (text.length()<min_length || text.compare(0, prefix_length, _str.data(), prefix_length)!=0)
+		return false;
+
+	auto &first=chunks.front();
+	if (chunks.size()==1) // No *
+		return text.length()==first.length && chunk_equal(text.data(), chunk(first));
+
+	auto &last=chunks.back();
+	if (!chunk_equal(text.data(), chunk(first)) || !chunk_equal(text.data()+text.length()-last.length, chunk(last)))
+		return false;
+
+	auto middle=text.substr(0, text.length()-last.length);
+	size_t pos=first.length;
+	for(size_t i=1;i<chunks.size()-1;i++){
+		auto &c=chunks[i];
+		if (c.length==0)
+			continue;
+		pos=chunk_find(middle, pos, chunk(c), c.has_any);
+		if (pos==std::string_view::npos)
 			return false;
-		
+		pos+=c.length;
 	}
-	
-	return ( T==endT && G==endG );
-}
\ No newline at end of file
+	return last.length>0 || pos<text.length(); // Trailing * needs at least one char
+}
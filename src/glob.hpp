@@ -4,9 +4,9 @@
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  *     http://www.apache.org/licenses/LICENSE-2.0
- * 
+ *
  * Unless required by applicable law or agreed to in writing, software
  * distributed under the License is distributed on an "AS IS" BASIS,
  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
@@ -14,11 +14,52 @@
  * limitations under the License.
  */
 
+#pragma once
+
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
 
 namespace loglang{
-	bool glob_match(const std::string &text, const std::string &glob);
+	bool glob_match(std::string_view text, std::string_view glob);
+	/// Whether the string has any wildcard
+	bool is_glob(std::string_view str);
+	/// Literal part of the glob up to the first wildcard. All matching texts start with it.
+	std::string_view glob_literal_prefix(std::string_view glob);
+
+	/**
+	 * @short A glob compiled for repeated matching.
+	 *
+	 * `*` matches any text, dots included, and `?` any single char; a trailing `*` needs at least
+	 * one char, so `easy.*` does not match `easy.`. The glob is split at the `*` into
+	 * chunks; the first chunk must be at the start of the text, the last at the end, and the others
+	 * are searched left to right in between. No recursion, no copies, and linear on the text
+	 * length for literal chunks.
+	 *
+	 * Texts that do not start with the literal prefix, or are too short, are rejected
+	 * before looking at the chunks.
+	 */
+	class Glob{
+		class Chunk{
+		public:
+			uint32_t start;
+			uint32_t length;
+			bool has_any; // Has some '?'
+		};
+		std::string _str;
+		std::vector<Chunk> chunks; // More than one if there is any *
+		size_t prefix_length;
+		size_t min_length;
+
+		std::string_view chunk(const Chunk &c) const { return std::string_view(_str).substr(c.start, c.length); }
+	public:
+		explicit Glob(std::string glob);
+
+		bool match(std::string_view text) const;
+		const std::string &str() const { return _str; }
+		std::string_view literal_prefix() const { return std::string_view(_str).substr(0, prefix_length); }
+	};
 // 	template<typename T>
 // 	std::vector<std::string> glob_filter(T I, T endI, std::string &glob){
 // 		std::vector<std::string> ret;
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <map>
+#include <algorithm>
+
+#include "glob.hpp"
+
+namespace loglang{
+	/**
+	 * @short Index of the subscribers (programs, aggregates) to a glob.
+	 *
+	 * Globs are stored in a trie by their leading literal dotted segments, so `disk.?d?.read` is at
+	 * `disk`, `cpu.cpu.*` at `cpu` → `cpu` and `*` at the root. To know which subscribers a key
+	 * matches only the nodes along the key path are checked, and not all the globs.
+	 *
+	 * Many subscribers may use the same glob.
+	 */
+	template<typename T>
+	class GlobIndex{
+		class Subscription{
+		public:
+			Glob glob;
+			std::vector<T> subscribers;
+		};
+		class Node{
+		public:
+			std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+			std::vector<Subscription> subscriptions;
+		};
+		Node root;
+
+		/// Node for the glob, or nullptr if does not exist and not create.
+		Node *find_node(const std::string &glob, bool create){
+			Node *node=&root;
+			size_t start=0, dot;
+			// Walk all full literal segments, the one with the first wildcard and next are checked by the Glob
+			while ( (dot=glob.find('.', start))!=std::string::npos && !is_glob(std::string_view(glob).substr(start, dot-start)) ){
+				auto segment=std::string_view(glob).substr(start, dot-start);
+				auto I=node->children.find(segment);
+				if (I==std::end(node->children)){
+					if (!create)
+						return nullptr;
+					I=node->children.emplace(std::string(segment), std::unique_ptr<Node>(new Node())).first;
+				}
+				node=I->second.get();
+				start=dot+1;
+			}
+			return node;
+		}
+	public:
+		void add(const std::string &glob, T subscriber){
+			Node *node=find_node(glob, true);
+			for(auto &sub: node->subscriptions){
+				if (sub.glob.str()==glob){
+					sub.subscribers.push_back(std::move(subscriber));
+					return;
+				}
+			}
+			node->subscriptions.push_back(Subscription{Glob(glob), {std::move(subscriber)}});
+		}
+		void remove(const std::string &glob, const T &subscriber){
+			Node *node=find_node(glob, false);
+			if (!node)
+				return;
+			auto &subs=node->subscriptions;
+			for(auto I=std::begin(subs), endI=std::end(subs); I!=endI; ++I){
+				if (I->glob.str()==glob){
+					auto &subscribers=I->subscribers;
+					subscribers.erase( std::remove(std::begin(subscribers), std::end(subscribers), subscriber), std::end(subscribers) );
+					if (subscribers.empty())
+						subs.erase(I);
+					return;
+				}
+			}
+		}
+		/// Returns all subscribers to a glob that matches the key
+		std::vector<T> match(std::string_view key) const{
+			std::vector<T> ret;
+			const Node *node=&root;
+			size_t start=0;
+			while (node){
+				for(auto &sub: node->subscriptions){
+					if (sub.glob.match(key))
+						ret.insert(std::end(ret), std::begin(sub.subscribers), std::end(sub.subscribers));
+				}
+				auto dot=key.find('.', start);
+				if (dot==std::string_view::npos)
+					break;
+				auto I=node->children.find(key.substr(start, dot-start));
+				node=(I==std::end(node->children)) ? nullptr : I->second.get();
+				start=dot+1;
+			}
+			return ret;
+		}
+	};
+}
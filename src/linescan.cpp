@@ -0,0 +1,180 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LOGLANG_X86 1
+#endif
+
+#include "linescan.hpp"
+
+using namespace loglang;
+
+namespace{
+	/// Fills the three bitmaps for a block of up to 64 bytes.
+	using classify_t = void (*)(const char *data, size_t len, uint64_t *newlines, uint64_t *hashes, uint64_t *spaces);
+
+	void classify_tail(const char *data, size_t len, uint64_t &nl, uint64_t &hash, uint64_t &space){
+		nl=hash=space=0;
+		for(size_t j=0;j<len;j++){
+			nl|=uint64_t(data[j]=='\n')<<j;
+			hash|=uint64_t(data[j]=='#')<<j;
+			space|=uint64_t(data[j]==' ')<<j;
+		}
+	}
+
+	void classify_scalar(const char *data, size_t len, uint64_t *newlines, uint64_t *hashes, uint64_t *spaces){
+		for(size_t w=0;w*64<len;w++)
+			classify_tail(data+w*64, std::min<size_t>(64, len-w*64), newlines[w], hashes[w], spaces[w]);
+	}
+
+#ifdef LOGLANG_X86
+	__attribute__((target("sse2")))
+	void classify_sse2(const char *data, size_t len, uint64_t *newlines, uint64_t *hashes, uint64_t *spaces){
+		const __m128i nl=_mm_set1_epi8('\n'), hash=_mm_set1_epi8('#'), space=_mm_set1_epi8(' ');
+		size_t w=0;
+		for(;(w+1)*64<=len;w++){
+			uint64_t n=0, h=0, s=0;
+			for(int k=0;k<4;k++){
+				auto block=_mm_loadu_si128((const __m128i*)(data+w*64+k*16));
+				n|=uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(block, nl))))<<(k*16);
+				h|=uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(block, hash))))<<(k*16);
+				s|=uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(block, space))))<<(k*16);
+			}
+			newlines[w]=n;
+			hashes[w]=h;
+			spaces[w]=s;
+		}
+		if (w*64<len)
+			classify_tail(data+w*64, len-w*64, newlines[w], hashes[w], spaces[w]);
+	}
+
+	__attribute__((target("avx2")))
+	void classify_avx2(const char *data, size_t len, uint64_t *newlines, uint64_t *hashes, uint64_t *spaces){
+		const __m256i nl=_mm256_set1_epi8('\n'), hash=_mm256_set1_epi8('#'), space=_mm256_set1_epi8(' ');
+		size_t w=0;
+		for(;(w+1)*64<=len;w++){
+			auto lo=_mm256_loadu_si256((const __m256i*)(data+w*64));
+			auto hi=_mm256_loadu_si256((const __m256i*)(data+w*64+32));
+			newlines[w]=uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))) | (uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl))))<<32);
+			hashes[w]=uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, hash))) | (uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, hash))))<<32);
+			spaces[w]=uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, space))) | (uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, space))))<<32);
+		}
+		if (w*64<len)
+			classify_tail(data+w*64, len-w*64, newlines[w], hashes[w], spaces[w]);
+	}
+#endif
+
+	const char *classify_name="scalar";
+
+	classify_t select_classify(){
+#ifdef LOGLANG_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")){
+			classify_name="avx2";
+			return classify_avx2;
+		}
+		if (__builtin_cpu_supports("sse2")){
+			classify_name="sse2";
+			return classify_sse2;
+		}
+#endif
+		return classify_scalar;
+	}
+
+	const classify_t classify_impl=select_classify();
+
+	/// As isspace at the C locale
+	inline bool is_space(char c){
+		return c==' ' || (c>='\t' && c<='\r');
+	}
+
+	/// Key and value from the line without the comment.
+	LineSpan trim_split(std::string_view raw, size_t b, size_t e, size_t space){
+		auto data=raw.data();
+		while (b<e && is_space(data[b]))
+			b++;
+		while (e>b && is_space(data[e-1]))
+			e--;
+		LineSpan s;
+		s.raw=raw;
+		s.line=std::string_view(data+b, e-b);
+		if (space<b){ // Was a leading space, look again
+			auto p=s.line.find(' ');
+			space=(p==std::string_view::npos) ? e : b+p;
+		}
+		if (space>=e){
+			s.key=s.line;
+			s.value=s.line; // As the old parser, a line with no space is also its own value
+		}
+		else{
+			s.key=std::string_view(data+b, space-b);
+			s.value=std::string_view(data+space+1, e-space-1);
+		}
+		return s;
+	}
+}
+
+const char *LineScanner::implementation()
+{
+	return classify_name;
+}
+
+void LineScanner::classify(const char *data, size_t len)
+{
+	size_t words=(len+63)/64;
+	newlines.resize(words);
+	hashes.resize(words);
+	spaces.resize(words);
+	classify_impl(data, len, newlines.data(), hashes.data(), spaces.data());
+}
+
+size_t LineScanner::find(const std::vector<uint64_t> &bits, size_t from, size_t to)
+{
+	if (from>=to)
+		return to;
+	size_t w=from/64;
+	uint64_t word=bits[w] & (~uint64_t(0) << (from%64));
+	while (true){
+		if (word)
+			return std::min(w*64+__builtin_ctzll(word), to);
+		if (++w*64>=to)
+			return to;
+		word=bits[w];
+	}
+}
+
+LineSpan LineScanner::span(const char *data, size_t start, size_t end) const
+{
+	auto cut=find(hashes, start, end);
+	auto space=find(spaces, start, cut);
+	if (space>=cut)
+		space=std::string_view::npos;
+	else
+		space-=start;
+	return trim_split(std::string_view(data+start, end-start), 0, cut-start, space);
+}
+
+LineSpan LineScanner::split(const char *line, size_t len)
+{
+	auto hash=(const char*)memchr(line, '#', len);
+	size_t cut=hash ? hash-line : len;
+	auto space=(const char*)memchr(line, ' ', cut);
+	return trim_split(std::string_view(line, len), 0, cut, space ? space-line : std::string_view::npos);
+}
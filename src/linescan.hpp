@@ -0,0 +1,80 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace loglang{
+	/**
+	 * @short Parts of an input line, pointing into the read buffer.
+	 *
+	 * Line is the text without comment and surrounding spaces; key is up to the first space, and
+	 * value after it. Raw is the line as read, as programs are only detected there.
+	 */
+	class LineSpan{
+	public:
+		std::string_view raw;
+		std::string_view line;
+		std::string_view key;
+		std::string_view value;
+	};
+
+	/**
+	 * @short Splits read buffers into lines and their key and value.
+	 *
+	 * First the whole buffer is classified into bitmaps of the positions of `\n`, `#` and spaces,
+	 * 64 bytes per word, with AVX2 or SSE2 if the CPU has them, and then each line is just a few
+	 * bit scans. Nothing is allocated per line.
+	 */
+	class LineScanner{
+		std::vector<uint64_t> newlines, hashes, spaces;
+
+		void classify(const char *data, size_t len);
+		/// First set bit in [from, to), or to.
+		static size_t find(const std::vector<uint64_t> &bits, size_t from, size_t to);
+		LineSpan span(const char *data, size_t start, size_t end) const;
+	public:
+		/**
+		 * @short Calls f(const LineSpan &) for each full line in data.
+		 *
+		 * Returns the length up to the end of the last full line; the rest is a partial line.
+		 */
+		template<typename F>
+		size_t scan(const char *data, size_t len, F &&f){
+			classify(data, len);
+			size_t start=0;
+			for(size_t w=0;w<newlines.size();w++){
+				auto bits=newlines[w];
+				while (bits){
+					size_t end=w*64+__builtin_ctzll(bits);
+					bits&=bits-1;
+					f(span(data, start, end));
+					start=end+1;
+				}
+			}
+			return start;
+		}
+
+		/// Same for a single line, with no newline.
+		static LineSpan split(const char *line, size_t len);
+		/// Which classifier is used: "avx2", "sse2" or "scalar".
+		static const char *implementation();
+	};
+}
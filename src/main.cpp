@@ -17,14 +17,23 @@
 #include <iostream>
 #include <fstream>
 #include <signal.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdio>
 
 #include "context.hpp"
 #include "utils.hpp"
 #include "feedbox.hpp"
+#include "sharded.hpp"
 
 namespace loglang{
 	std::function<void()> stop_cb;
-	bool debug=false;
+	extern bool debug;
+	extern bool check_vm;
+	extern bool units;
+	std::atomic<bool> stats_requested{false};
+	std::atomic<bool> trace_requested{false};
 }
 
 void stop(int){
@@ -33,6 +42,52 @@ void stop(int){
 		loglang::stop_cb();
 }
 
+void request_stats(int){
+	loglang::stats_requested=true;
+}
+
+void request_trace(int){
+	loglang::trace_requested=true;
+}
+
+/// Writes to the file, replacing it at once.
+static void write_file(const std::string &filename, std::function<void (std::ostream &)> f){
+	auto tmpname=filename+".tmp";
+	{
+		std::ofstream out(tmpname);
+		f(out);
+		if (!out){
+			std::cerr<<tmpname<<": Could not write."<<std::endl;
+			return;
+		}
+	}
+	if (rename(tmpname.c_str(), filename.c_str())<0)
+		perror(filename.c_str());
+}
+
+/// Writes the program stats to the file, or to stderr if no file.
+static void write_stats(const loglang::Context &context, const std::string &filename){
+	if (filename.empty())
+		context.write_stats(std::cerr);
+	else
+		write_file(filename, [&context](std::ostream &out){ context.write_stats(out); });
+}
+
+static void save_snapshot(loglang::Context &context, const std::string &filename){
+	try{
+		context.save_snapshot(filename);
+	}
+	catch(const std::exception &e){
+		std::cerr<<"Could not write snapshot: "<<e.what()<<std::endl;
+	}
+}
+
+static void write_trace(const loglang::Context &context, const std::string &filename){
+	write_file(filename, [&context](std::ostream &out){ context.tracer()->write_json(out); });
+	if (loglang::debug)
+		std::cerr<<"Trace written to "<<filename<<", "<<context.tracer()->spans()<<" spans so far."<<std::endl;
+}
+
 int main(int argc, char **argv){
 // 	auto &input=std::cin;
 // 	input.sync_with_stdio(false);
@@ -41,24 +96,150 @@ int main(int argc, char **argv){
 	signal(SIGTERM, stop);
 	signal(SIGINT, stop);
 	
-	auto context=std::make_shared<loglang::Context>();
-	loglang::FeedBox feedbox(context);
+	loglang::BatchWindow batch;
+	size_t ring_size=0;
+	unsigned backfill_threads=std::thread::hardware_concurrency();
+	unsigned nshards=0;
+	std::vector<std::string> files;
+	std::string stats_file;
+	std::chrono::seconds stats_interval{10};
+	std::string trace_file;
+	size_t trace_spans=65536;
+	std::string snapshot_file;
+	std::chrono::seconds snapshot_interval{60};
+	loglang::ChangeLog::Options change_log;
+	std::string program_cache;
+	for(int i=1;i<argc;i++){
+		if (argv[i]==std::string("--debug"))
+			loglang::debug=true;
+		else if (argv[i]==std::string("--check-vm"))
+			loglang::check_vm=true;
+		else if (argv[i]==std::string("--units"))
+			loglang::units=true;
+		else if (argv[i]==std::string("--batch-marker") && i+1<argc)
+			batch.marker=argv[++i];
+		else if (argv[i]==std::string("--batch-lines") && i+1<argc)
+			batch.lines=atoi(argv[++i]);
+		else if (argv[i]==std::string("--batch-ms") && i+1<argc)
+			batch.time=std::chrono::milliseconds(atoi(argv[++i]));
+		else if (argv[i]==std::string("--backfill-threads") && i+1<argc)
+			backfill_threads=atoi(argv[++i]);
+		else if (argv[i]==std::string("--pipeline")){
+			if (ring_size==0)
+				ring_size=4096;
+		}
+		else if (argv[i]==std::string("--ring-size") && i+1<argc)
+			ring_size=atoi(argv[++i]);
+		else if (argv[i]==std::string("--shards") && i+1<argc)
+			nshards=atoi(argv[++i]);
+		else if (argv[i]==std::string("--stats-file") && i+1<argc)
+			stats_file=argv[++i];
+		else if (argv[i]==std::string("--stats-interval") && i+1<argc)
+			stats_interval=std::chrono::seconds(std::max(1, atoi(argv[++i])));
+		else if (argv[i]==std::string("--trace-file") && i+1<argc)
+			trace_file=argv[++i];
+		else if (argv[i]==std::string("--trace-spans") && i+1<argc)
+			trace_spans=atoi(argv[++i]);
+		else if (argv[i]==std::string("--snapshot") && i+1<argc)
+			snapshot_file=argv[++i];
+		else if (argv[i]==std::string("--snapshot-interval") && i+1<argc)
+			snapshot_interval=std::chrono::seconds(std::max(1, atoi(argv[++i])));
+		else if (argv[i]==std::string("--program-cache") && i+1<argc)
+			program_cache=argv[++i];
+		else if (argv[i]==std::string("--change-log") && i+1<argc)
+			change_log.path=argv[++i];
+		else if (argv[i]==std::string("--change-log-sync") && i+1<argc)
+			change_log.sync_interval=std::chrono::milliseconds(std::max(0, atoi(argv[++i])));
+		else if (argv[i]==std::string("--change-log-segment") && i+1<argc)
+			change_log.segment_size=size_t(std::max(1, atoi(argv[++i])))<<20;
+		else
+			files.push_back(argv[i]);
+	}
+	
+	std::shared_ptr<loglang::Context> context;
+	std::shared_ptr<loglang::ShardedContext> sharded;
+	std::shared_ptr<loglang::FeedTarget> target;
+	if (nshards>0){
+		if (batch.enabled())
+			std::cerr<<"Batch windows are not supported with --shards, ignored."<<std::endl;
+		sharded=std::make_shared<loglang::ShardedContext>(nshards);
+		target=sharded;
+	}
+	else{
+		context=std::make_shared<loglang::Context>();
+		context->set_batch_window(batch);
+		target=context;
+	}
+	loglang::FeedBox feedbox(target);
+	feedbox.set_backfill_threads(backfill_threads);
+	feedbox.set_pipeline(ring_size);
 
 // 	context->set_output([](const std::string &output){ std::cout<<">> "<<output<<std::endl; });
 	loglang::stop_cb=[&feedbox](){ feedbox.stop(); };
+	if (context){
+		signal(SIGUSR1, request_stats);
+		if (!trace_file.empty()){
+			context->enable_tracing(trace_spans);
+			signal(SIGUSR2, request_trace);
+		}
+		// Before the rules, that keep the state if the same
+		uint64_t log_segment=0;
+		try{
+			if (!program_cache.empty())
+				context->program_cache().open(program_cache);
+			if (!snapshot_file.empty())
+				context->load_snapshot(snapshot_file, &log_segment);
+			if (!change_log.path.empty()){
+				context->replay_change_log(change_log.path, log_segment);
+				context->set_change_log(std::make_unique<loglang::ChangeLog>(change_log, log_segment));
+			}
+		}
+		catch(const std::exception &e){
+			std::cerr<<"Could not restore the state: "<<e.what()<<std::endl;
+			return 1;
+		}
+		auto next_stats=std::chrono::steady_clock::now()+stats_interval;
+		auto next_snapshot=std::chrono::steady_clock::now()+snapshot_interval;
+		feedbox.set_periodic([&context, &stats_file, &trace_file, &snapshot_file, &next_stats, &next_snapshot, stats_interval, snapshot_interval](){
+			if (loglang::trace_requested.exchange(false))
+				write_trace(*context, trace_file);
+			auto now=std::chrono::steady_clock::now();
+			bool due=!stats_file.empty() && now>=next_stats;
+			if (loglang::stats_requested.exchange(false) || due)
+				write_stats(*context, stats_file);
+			if (due)
+				next_stats=now+stats_interval;
+			if (!snapshot_file.empty() && now>=next_snapshot){
+				save_snapshot(*context, snapshot_file);
+				next_snapshot=now+snapshot_interval;
+			}
+			auto next=std::chrono::steady_clock::time_point::max();
+			if (!stats_file.empty())
+				next=next_stats;
+			if (!snapshot_file.empty())
+				next=std::min(next, next_snapshot);
+			int timeout=-1;
+			if (next!=std::chrono::steady_clock::time_point::max())
+				timeout=int(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(next-now).count()));
+			if (context->change_log()){ // Group commit of the lines read since the last loop
+				auto sync=context->change_log()->commit();
+				if (sync>=0 && (timeout<0 || sync<timeout))
+					timeout=sync;
+			}
+			return timeout;
+		});
+	}
+	else if (!stats_file.empty() || !trace_file.empty() || !snapshot_file.empty() || !change_log.path.empty() || !program_cache.empty())
+		std::cerr<<"Program stats, traces, snapshots, the change log and the program cache file are not supported with --shards, ignored."<<std::endl;
 
 	try{
-		for(int i=1;i<argc;i++){
-			if (argv[i]==std::string("--debug"))
-				loglang::debug=true;
-			else{
-				try{
-					feedbox.add_feed( argv[i], true);
-				}
-				catch(const std::exception &ex){
-					std::cerr<<argv[i] <<": "<<ex.what()<<std::endl;
-					return 1;
-				}
+		for(auto &file: files){
+			try{
+				feedbox.add_feed( file, true);
+			}
+			catch(const std::exception &ex){
+				std::cerr<<file <<": "<<ex.what()<<std::endl;
+				return 1;
 			}
 		}
 		feedbox.add_feed( "<stdin>", false);
@@ -68,9 +249,23 @@ int main(int argc, char **argv){
 		std::cerr<<"Uncatched exception. "<<e.what()<<std::endl;
 		return 1;
 	}
+	if (sharded)
+		sharded->wait_idle();
+	else{
+		if (!stats_file.empty())
+			write_stats(*context, stats_file);
+		if (!trace_file.empty())
+			write_trace(*context, trace_file);
+		if (!snapshot_file.empty())
+			save_snapshot(*context, snapshot_file);
+		context->set_change_log(nullptr); // Written and synced
+	}
 	if (loglang::debug){
 		std::cerr<<"--- Final memory status:"<<std::endl;
-		context->debug_values();
+		if (sharded)
+			sharded->debug_values();
+		else
+			context->debug_values();
 	}
 	
 	return 0;
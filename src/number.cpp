@@ -0,0 +1,148 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <charconv>
+#include <limits>
+#include <cstdint>
+#include <cctype>
+
+#include "number.hpp"
+
+using namespace loglang;
+
+namespace{
+	inline bool is_digit(char c){
+		return c>='0' && c<='9';
+	}
+	inline bool is_space(char c){
+		return c==' ' || (c>='\t' && c<='\r');
+	}
+
+	/// Signed int from the magnitude; false if it does not fit.
+	bool to_signed(uint64_t u, bool negative, int64_t &out){
+		if (negative){
+			if (u>uint64_t(std::numeric_limits<int64_t>::max())+1)
+				return false;
+			out=int64_t(0-u);
+			return true;
+		}
+		if (u>uint64_t(std::numeric_limits<int64_t>::max()))
+			return false;
+		out=int64_t(u);
+		return true;
+	}
+
+	/// Multiplier of the unit suffix at p, and moves p after it; 1 and p as is if none.
+	uint64_t parse_unit(const char *&p, const char *end){
+		auto q=p;
+		while (q<end && (*q==' ' || *q=='\t'))
+			q++;
+		if (q>=end)
+			return 1;
+		uint64_t mult=1;
+		switch(*q){
+			case 'k': case 'K': mult=uint64_t(1)<<10; break;
+			case 'M': mult=uint64_t(1)<<20; break;
+			case 'G': mult=uint64_t(1)<<30; break;
+			case 'T': mult=uint64_t(1)<<40; break;
+			case 'P': mult=uint64_t(1)<<50; break;
+			case 'B': break;
+			default:
+				return 1;
+		}
+		if (*q++!='B'){
+			if (end-q>=2 && q[0]=='i' && q[1]=='B')
+				q+=2;
+			else if (q<end && *q=='B')
+				q++;
+		}
+		if (q<end && !is_space(*q)) // Some other word, as `kbps`
+			return 1;
+		p=q;
+		return mult;
+	}
+}
+
+size_t loglang::parse_number(std::string_view text, any &value, bool units)
+{
+	const char *begin=text.data(), *end=begin+text.length(), *p=begin;
+	while (p<end && is_space(*p))
+		p++;
+	bool negative=false;
+	if (p<end && (*p=='+' || *p=='-')){
+		negative=(*p=='-');
+		p++;
+	}
+	if (p>=end)
+		return 0;
+
+	int64_t i=0;
+	double d=0;
+	bool is_int=false;
+	if (end-p>2 && p[0]=='0' && (p[1]=='x' || p[1]=='X') && std::isxdigit((unsigned char)p[2])){
+		uint64_t u=0;
+		auto res=std::from_chars(p+2, end, u, 16);
+		if (res.ec==std::errc::result_out_of_range){ // Wider than 64 bits, a double as with decimals
+			for(auto q=p+2;q<res.ptr;q++)
+				d=d*16+(is_digit(*q) ? *q-'0' : (*q|0x20)-'a'+10);
+			if (negative)
+				d=-d;
+		}
+		else if (to_signed(u, negative, i))
+			is_int=true;
+		else // Too big for int64, a double as with decimals
+			d=negative ? -double(u) : double(u);
+		p=res.ptr;
+	}
+	else{
+		auto digits=p;
+		while (p<end && is_digit(*p))
+			p++;
+		if (p>digits && (p==end || (*p!='.' && *p!='e' && *p!='E'))){
+			uint64_t u=0;
+			auto res=std::from_chars(digits, p, u);
+			is_int=(res.ec==std::errc() && to_signed(u, negative, i));
+		}
+		if (!is_int){
+			if (digits<end && (*digits=='+' || *digits=='-')) // from_chars would take a second sign
+				return 0;
+			auto res=std::from_chars(digits, end, d);
+			if (res.ec==std::errc::invalid_argument)
+				return 0;
+			if (res.ec==std::errc::result_out_of_range) // As strtod, huge or tiny
+				d=std::numeric_limits<double>::infinity();
+			if (negative)
+				d=-d;
+			p=res.ptr;
+		}
+	}
+
+	if (units){
+		auto mult=parse_unit(p, end);
+		if (mult!=1){
+			if (is_int && (i>int64_t(std::numeric_limits<int64_t>::max()/mult) || i<int64_t(std::numeric_limits<int64_t>::min()/int64_t(mult)))){
+				d=double(i);
+				is_int=false;
+			}
+			if (is_int)
+				i*=int64_t(mult);
+			else
+				d*=double(mult);
+		}
+	}
+	value=is_int ? any(i) : any(d);
+	return p-begin;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+#include "value.hpp"
+
+namespace loglang{
+	/**
+	 * @short Parses the number at the start of text, keeping ints as ints.
+	 *
+	 * Digits only are an int, as `-12`, and `0x1f` is an hex int; with a fraction or exponent, or
+	 * too big for an int64, it is a double. Leading spaces are skipped, and the rest after the
+	 * number ignored, as atof does. No allocation, and does not depend on the locale.
+	 *
+	 * With units a suffix as ` kB` multiplies the value: k, M, G, T and P, alone or followed by
+	 * B or iB, are powers of 1024, as at /proc/meminfo; B alone is 1.
+	 *
+	 * Returns the chars used, or 0 if there is no number, and then value is not changed.
+	 */
+	size_t parse_number(std::string_view text, any &value, bool units=false);
+}
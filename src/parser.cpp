@@ -21,6 +21,7 @@
 #include "ast.hpp"
 #include "ast_all.hpp"
 #include "program.hpp"
+#include "glob.hpp"
 
 using namespace loglang;
 namespace loglang{
@@ -253,6 +254,9 @@ AST Parser::parse_val()
 	if (tok.type==Token::NUMBER || tok.type==Token::STRING){
 		return std::make_unique<ast::Value_const>(tok);
 	}
+	if (tok.type==Token::CAPTURE){
+		return std::make_unique<ast::Value_capture>(tok);
+	}
 	if (tok.token=="*") // All vars glob
 		tok.type=Token::VAR; 
 	if (tok.type==Token::VAR){
@@ -265,7 +269,7 @@ AST Parser::parse_val()
 		}
 		tokenizer.rewind();
 		if (tok.type==Token::VAR){
-			if (std::find(std::begin(tok.token), std::end(tok.token), '*')==std::end(tok.token) && std::find(std::begin(tok.token), std::end(tok.token), '?')==std::end(tok.token))
+			if (!is_glob(tok.token))
 				return std::make_unique<ast::Value_var>(tok);
 			else
 				return std::make_unique<ast::Value_glob>(tok);
@@ -16,39 +16,139 @@
 
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 
 #include "program.hpp"
 #include "parser.hpp"
+#include "context.hpp"
 
 namespace loglang{
 	extern bool debug;
+	extern bool check_vm;
 }
 
 using namespace loglang;
 
-Program::Program(std::string _name, std::string _sourcecode) : name(std::move(_name)), sourcecode(std::move(_sourcecode))
+Program::Program(std::string name, std::string _sourcecode, Context &context) : _name(std::move(name)), sourcecode(std::move(_sourcecode))
 {
-	ast=parse_program(sourcecode);
+	if (check_vm) // Its own, as the AST keeps the state of at and edge_if
+		compiled=CompiledProgram::compile(sourcecode);
+	else
+		compiled=context.program_cache().get(sourcecode);
+	auto &bytecode=compiled->bytecode;
 	
-	_dependencies=ast->dependencies();
+	bindings=Bindings(bytecode, context);
+	state.resize(bytecode.nstate);
+	for(auto &in: bytecode.code){
+		if (in.op==Instr::STORE && std::find(std::begin(_stores), std::end(_stores), bindings.symbols[in.a])==std::end(_stores))
+			_stores.push_back(bindings.symbols[in.a]);
+	}
 	
 	if (debug){
-		std::cerr<<name;
+		std::cerr<<_name;
 // 		std::cerr<<" deps "<<std::to_string(_dependencies);
-		std::cerr<<" compiled "<<_sourcecode<<" ast "<<ast->to_string()<<std::endl;
+		std::cerr<<" compiled "<<sourcecode;
+		if (compiled->ast)
+			std::cerr<<" ast "<<compiled->ast->to_string();
+		std::cerr<<std::endl;
+		std::cerr<<bytecode.to_string();
 	}
 }
 
-void Program::run(Context& context)
+void Program::run(Context& context, Symbol *trigger)
 {
-// 	std::cerr<<"Run "<<name<<std::endl;
-	if (ast){
-		try{
-			auto output=ast->eval(context);
-		}
-		catch(const std::exception &e){
-			std::cerr<<"ERROR running "<< name <<": "<<e.what()<<std::endl;
-		}
+// 	std::cerr<<"Run "<<_name<<std::endl;
+	auto start=ticks();
+	auto changes=context.changes();
+	auto state_writes=context.vm().state_writes;
+	auto tracer=context.tracer();
+	if (tracer){
+		if (!trace_name)
+			trace_name=tracer->intern(_name);
+		tracer->begin_program(trace_name, trigger, start);
+	}
+	try{
+		if (check_vm)
+			run_checked(context);
+		else
+			context.vm().run(compiled->bytecode, bindings, state, context);
+	}
+	catch(const std::exception &e){
+		stats.errors++;
+		std::cerr<<"ERROR running "<< _name <<": "<<e.what()<<std::endl;
+	}
+	auto end=ticks();
+	stats.add_run(end-start, context.changes()-changes);
+	if (tracer)
+		tracer->end_program(end);
+	if (context.vm().state_writes!=state_writes && context.change_log())
+		context.change_log()->state(*this);
 // 		context.output(output);
+}
+
+bool Program::restore_state(std::vector<any> s)
+{
+	if (s.size()!=state.size())
+		return false;
+	state=std::move(s);
+	return true;
+}
+
+static bool same_value(const any &a, const any &b){
+	if (!a || !b)
+		return !a && !b;
+	return a==b;
+}
+
+/**
+ * @short Runs both the VM and the AST, and complains if results differ.
+ * 
+ * The VM runs first as a dry run, so it does not change any symbol, and then the AST runs
+ * for real. Results and the list of direct stores must be the same.
+ */
+void Program::run_checked(Context& context)
+{
+	store_log vm_stores, ast_stores;
+	any vm_res;
+	std::string vm_error;
+	auto prev_muted=context.set_muted(true);
+	try{
+		vm_res=context.vm().run(compiled->bytecode, bindings, state, context, &vm_stores);
+	}
+	catch(const std::exception &e){
+		vm_error=e.what();
+	}
+	context.set_muted(prev_muted);
+	
+	auto prev_journal=context.set_journal(&ast_stores);
+	any ast_res;
+	try{
+		ast_res=compiled->ast->eval(context);
+	}
+	catch(const std::exception &e){
+		context.set_journal(prev_journal);
+		if (vm_error.empty())
+			std::cerr<<"VM MISMATCH at "<<_name<<": AST throws "<<e.what()<<", VM does not."<<std::endl;
+		throw;
+	}
+	context.set_journal(prev_journal);
+	
+	if (!vm_error.empty()){
+		std::cerr<<"VM MISMATCH at "<<_name<<": VM throws "<<vm_error<<", AST does not."<<std::endl;
+		return;
+	}
+	if (!same_value(vm_res, ast_res))
+		std::cerr<<"VM MISMATCH at "<<_name<<": VM result "<<std::to_string(vm_res)<<", AST result "<<std::to_string(ast_res)<<std::endl;
+	bool same_stores=vm_stores.size()==ast_stores.size();
+	for(size_t i=0; same_stores && i<vm_stores.size(); i++)
+		same_stores=vm_stores[i].first==ast_stores[i].first && same_value(vm_stores[i].second, ast_stores[i].second);
+	if (!same_stores){
+		std::cerr<<"VM MISMATCH at "<<_name<<": VM stores";
+		for(auto &st: vm_stores)
+			std::cerr<<" "<<st.first<<"="<<std::to_string(st.second);
+		std::cerr<<", AST stores";
+		for(auto &st: ast_stores)
+			std::cerr<<" "<<st.first<<"="<<std::to_string(st.second);
+		std::cerr<<std::endl;
 	}
 }
@@ -19,21 +19,49 @@
 #include <string>
 #include <set>
 #include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "bytecode.hpp"
+#include "vm.hpp"
+#include "stats.hpp"
+#include "programcache.hpp"
 
 namespace loglang{
 	class Context;
-	class ASTBase;
 	
 	class Program{
-		std::string name;
+		std::string _name;
 		std::string sourcecode;
-		std::set<std::string> _dependencies;
-		std::shared_ptr<ASTBase> ast;
+		std::shared_ptr<const CompiledProgram> compiled; // Shared with the programs with the same source
+		Bindings bindings;
+		std::vector<any> state; // State of edge_if and at, for the VM. The AST keeps its own.
+		std::vector<Symbol*> _stores; // Symbols this program may set
 		
+		void run_checked(Context &context);
 	public:
-		Program(std::string name, std::string sourcecode);
-		const std::set<std::string> &dependencies() const { return _dependencies; }
+		Program(std::string name, std::string sourcecode, Context &context);
+		const std::string &name() const { return _name; }
+		const std::set<std::string> &dependencies() const { return compiled->dependencies; }
+		const std::vector<Symbol*> &stores() const { return _stores; }
+		const std::string &source() const { return sourcecode; }
+		/// Previous values of its at and edge_if, as the VM keeps them.
+		const std::vector<any> &vm_state() const { return state; }
+		/// Returns false, and keeps the current one, if it does not fit this program.
+		bool restore_state(std::vector<any> s);
+		
+		// Scheduler state
+		uint64_t sequence=0; // Definition order
+		uint32_t rank=0;
+		bool queued=false;
+		bool removed=false; // Removed or redefined; if still queued, it does not run
+		std::shared_ptr<Program> replacement; // If redefined, runs instead when it depends on the trigger
+		uint64_t last_run=0; // Scheduler epoch
+		
+		ProgramStats stats;
+		const std::string *trace_name=nullptr; // Interned at the context tracer
 		
-		void run(Context &context);
+		/// Runs it; trigger is the symbol that scheduled it, if any, for the trace.
+		void run(Context &context, Symbol *trigger=nullptr);
 	};
 }
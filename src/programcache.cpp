@@ -0,0 +1,351 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "programcache.hpp"
+#include "parser.hpp"
+#include "binary.hpp"
+#include "aggregate.hpp"
+#include "utils.hpp"
+
+namespace loglang{
+	extern bool debug;
+}
+
+using namespace loglang;
+
+/*
+ * File layout, in native byte order:
+ *
+ *   magic[8] version:u32
+ *   { len:u32 checksum:u64 entry }*   the checksum is FNV-1a of the entry
+ *
+ * An entry, with varints and compact values as BinaryWriter writes them, is the source, the
+ * dependencies, and the bytecode: code as op dst a b:u16, constants, the symbols, globs,
+ * functions and aggregates tables, and nregisters nstate result:u16.
+ *
+ * The version is a hash of the format number and of the entry of a probe program, so any change
+ * of the compiler output or of the instruction set starts a new file.
+ */
+namespace{
+	const char magic[8]={'L','O','G','L','P','C','C','H'};
+	const uint32_t format=2; // Bump when the entry layout changes
+	const char *probe="at t do { a = sum(c.*) + max(c.*) + 1 * 2 - 3 / 4 ; edge_if a >= 1 and a <= 5 or a != 2 then print(\"x\") else b = round(a, 1) ; }";
+	const size_t file_header=sizeof(magic)+sizeof(uint32_t);
+	const size_t frame_header=sizeof(uint32_t)+sizeof(uint64_t);
+
+	void put_strings(BinaryWriter &w, const std::vector<std::string> &list){
+		w.put_length(list.size());
+		for(auto &s: list)
+			w.put_str(s);
+	}
+	std::vector<std::string> get_strings(BinaryReader &r){
+		std::vector<std::string> list(r.get_length());
+		for(auto &s: list)
+			s=r.get_str();
+		return list;
+	}
+
+	void put_entry(BinaryWriter &w, const std::string &source, const CompiledProgram &compiled){
+		w.put_str(source);
+		w.put_length(compiled.dependencies.size());
+		for(auto &dep: compiled.dependencies)
+			w.put_str(dep);
+		auto &bc=compiled.bytecode;
+		w.put_length(bc.code.size());
+		for(auto &in: bc.code){
+			w.put(uint16_t(in.op));
+			w.put(in.dst);
+			w.put(in.a);
+			w.put(in.b);
+		}
+		w.put_length(bc.constants.size());
+		for(auto &c: bc.constants)
+			w.put_value(c);
+		put_strings(w, bc.symbols);
+		put_strings(w, bc.globs);
+		put_strings(w, bc.functions);
+		put_strings(w, bc.aggregates);
+		w.put(bc.nregisters);
+		w.put(bc.nstate);
+		w.put(bc.result);
+	}
+
+	uint32_t file_version(){
+		static uint32_t version=[]{
+			BinaryWriter w(true);
+			w.put(format);
+			w.put(uint32_t(sizeof(Instr)));
+			w.put(uint32_t(Instr::CAPTURE));
+			put_entry(w, probe, *CompiledProgram::compile(probe));
+			return uint32_t(fnv1a(w.buffer.data(), w.buffer.size()));
+		}();
+		return version;
+	}
+
+	/// Checks that all the operands are inside their tables, so the VM can run it.
+	bool valid_bytecode(const Bytecode &bc){
+		size_t nregs=bc.nregisters, ncode=bc.code.size();
+		for(auto &in: bc.code){
+			bool ok=true;
+			switch(in.op){
+				case Instr::NOP:
+					break;
+				case Instr::NIL:
+					ok=in.dst<nregs;
+					break;
+				case Instr::CONST:
+					ok=in.dst<nregs && in.a<bc.constants.size();
+					break;
+				case Instr::LOAD:
+					ok=in.dst<nregs && in.a<bc.symbols.size();
+					break;
+				case Instr::GLOB:
+					ok=in.dst<nregs && in.a<bc.globs.size();
+					break;
+				case Instr::STORE:
+					ok=in.a<bc.symbols.size() && in.b<nregs;
+					break;
+				case Instr::CALL:
+					ok=in.dst+size_t(in.b)<=nregs && in.dst<nregs && in.a<bc.functions.size();
+					break;
+				case Instr::JMP:
+					ok=in.a<=ncode;
+					break;
+				case Instr::JF:
+					ok=in.a<=ncode && in.b<nregs;
+					break;
+				case Instr::EDGE:
+				case Instr::AT:
+					ok=in.dst<bc.nstate && in.a<=ncode && in.b<nregs;
+					break;
+				case Instr::AGG:
+					ok=in.dst<nregs && in.a<bc.aggregates.size() && in.b<=GlobAggregate::AVG;
+					break;
+				case Instr::CAPTURE:
+					ok=in.dst<nregs;
+					break;
+				default: // Arithmetic and comparisons, all registers
+					ok=in.op<=Instr::CAPTURE && in.dst<nregs && in.a<nregs && in.b<nregs;
+			}
+			if (!ok)
+				return false;
+		}
+		return bc.result<nregs;
+	}
+}
+
+std::shared_ptr<CompiledProgram> CompiledProgram::compile(const std::string &source)
+{
+	auto compiled=std::make_shared<CompiledProgram>();
+	compiled->ast=parse_program(source);
+	compiled->dependencies=compiled->ast->dependencies();
+	loglang::compile(*compiled->ast, compiled->bytecode);
+	return compiled;
+}
+
+ProgramCache::~ProgramCache()
+{
+	if (fd>=0)
+		close(fd);
+}
+
+std::shared_ptr<const CompiledProgram> ProgramCache::get(const std::string &source)
+{
+	auto hash=fnv1a(source.data(), source.length());
+	auto I=entries.find(hash);
+	if (I!=std::end(entries) && I->second.source==source){
+		_hits++;
+		return I->second.compiled;
+	}
+
+	std::shared_ptr<const CompiledProgram> compiled;
+	auto D=on_disk.find(hash);
+	if (D!=std::end(on_disk)){
+		compiled=load(D->second, source);
+		if (compiled)
+			_disk_hits++;
+	}
+	if (!compiled){
+		auto fresh=CompiledProgram::compile(source);
+		_misses++;
+		if (fd>=0)
+			append(source, *fresh);
+		compiled=std::move(fresh);
+	}
+
+	if (entries.size()>=max_entries){ // Drop the ones no program uses
+		for(auto E=std::begin(entries); E!=std::end(entries);){
+			if (E->second.compiled.use_count()==1)
+				E=entries.erase(E);
+			else
+				++E;
+		}
+	}
+	entries[hash]=Entry{source, compiled};
+	return compiled;
+}
+
+/// Returns nullptr if it is not a valid entry for that source.
+std::shared_ptr<const CompiledProgram> ProgramCache::load(std::string_view data, const std::string &source) const
+{
+	try{
+		BinaryReader r(data.data(), data.length(), true);
+		if (r.get_str()!=source)
+			return nullptr;
+		auto compiled=std::make_shared<CompiledProgram>();
+		for(auto &dep: get_strings(r))
+			compiled->dependencies.insert(std::move(dep));
+		auto &bc=compiled->bytecode;
+		auto ncode=r.get_length();
+		r.need(ncode*4*sizeof(uint16_t));
+		for(size_t i=0;i<ncode;i++){
+			auto op=Instr::op_t(r.get<uint16_t>());
+			auto dst=r.get<uint16_t>();
+			auto a=r.get<uint16_t>();
+			auto b=r.get<uint16_t>();
+			bc.code.emplace_back(op, dst, a, b);
+		}
+		auto nconstants=r.get_length();
+		for(size_t i=0;i<nconstants;i++)
+			bc.constants.push_back(r.get_value());
+		bc.symbols=get_strings(r);
+		bc.globs=get_strings(r);
+		bc.functions=get_strings(r);
+		bc.aggregates=get_strings(r);
+		bc.nregisters=r.get<uint16_t>();
+		bc.nstate=r.get<uint16_t>();
+		bc.result=r.get<uint16_t>();
+		if (!valid_bytecode(bc))
+			throw std::runtime_error("operand out of range");
+		return compiled;
+	}
+	catch(const std::exception &e){
+		if (debug)
+			std::cerr<<"Program cache entry not valid, compiled again: "<<e.what()<<std::endl;
+		return nullptr;
+	}
+}
+
+void ProgramCache::append(const std::string &source, const CompiledProgram &compiled)
+{
+	BinaryWriter w(true);
+	w.buffer.assign(frame_header, '\0');
+	put_entry(w, source, compiled);
+
+	uint32_t len=w.buffer.size()-frame_header;
+	uint64_t checksum=fnv1a(w.buffer.data()+frame_header, len);
+	memcpy(&w.buffer[0], &len, sizeof(len));
+	memcpy(&w.buffer[sizeof(len)], &checksum, sizeof(checksum));
+	// A single write; if torn, the entry is dropped at the next open
+	if (write(fd, w.buffer.data(), w.buffer.size())!=ssize_t(w.buffer.size()))
+		std::cerr<<"Could not write to the program cache: "<<strerror(errno)<<std::endl;
+}
+
+/**
+ * The file is rewritten with the valid entries, the last of each source and at most
+ * max_entries, the newest, if that drops any; so it does not grow forever with the programs
+ * of old deploys. A torn entry at the end is dropped the same way.
+ */
+void ProgramCache::open(const std::string &filename)
+{
+	std::string contents;
+	int rfd=::open(filename.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (rfd<0)
+		throw std::runtime_error(filename+": "+strerror(errno));
+	char buffer[1<<16];
+	ssize_t n;
+	while ((n=read(rfd, buffer, sizeof(buffer)))!=0){
+		if (n<0 && errno==EINTR)
+			continue;
+		if (n<0){
+			auto err=errno;
+			close(rfd);
+			throw std::runtime_error(filename+": "+strerror(err));
+		}
+		contents.append(buffer, n);
+	}
+	close(rfd);
+
+	BinaryWriter header;
+	header.buffer.append(magic, sizeof(magic));
+	header.put(file_version());
+	std::vector<std::pair<uint64_t, std::string_view>> frames; // Hash of the source, and the whole frame
+	if (contents.compare(0, file_header, header.buffer)==0){
+		size_t pos=file_header;
+		while (contents.size()-pos>=frame_header){
+			uint32_t len;
+			uint64_t checksum;
+			memcpy(&len, contents.data()+pos, sizeof(len));
+			memcpy(&checksum, contents.data()+pos+sizeof(len), sizeof(checksum));
+			if (contents.size()-pos-frame_header<len || fnv1a(contents.data()+pos+frame_header, len)!=checksum)
+				break;
+			try{
+				BinaryReader r(contents.data()+pos+frame_header, len, true);
+				auto source=r.get_str();
+				frames.emplace_back(fnv1a(source.data(), source.length()), std::string_view(contents.data()+pos, frame_header+len));
+			}
+			catch(const std::exception &){
+				break;
+			}
+			pos+=frame_header+len;
+		}
+	}
+	else if (!contents.empty())
+		std::cerr<<filename<<": Not a program cache of this version, started again."<<std::endl;
+
+	std::unordered_map<uint64_t, size_t> last;
+	for(size_t i=0;i<frames.size();i++)
+		last[frames[i].first]=i;
+	std::vector<size_t> keep;
+	for(size_t i=0;i<frames.size();i++){
+		if (last[frames[i].first]==i)
+			keep.push_back(i);
+	}
+	if (keep.size()>max_entries)
+		keep.erase(std::begin(keep), std::end(keep)-max_entries);
+	disk=header.buffer;
+	for(auto i: keep)
+		disk.append(frames[i].second);
+	if (disk!=contents){
+		write_file_synced(filename, disk);
+		if (debug)
+			std::cerr<<"Program cache "<<filename<<" rewritten, "<<frames.size()-keep.size()<<" entries dropped."<<std::endl;
+	}
+	on_disk.clear();
+	for(size_t pos=file_header;pos<disk.size();){
+		uint32_t len;
+		memcpy(&len, disk.data()+pos, sizeof(len));
+		std::string_view data(disk.data()+pos+frame_header, len);
+		BinaryReader r(data.data(), data.length(), true);
+		auto source=r.get_str();
+		on_disk[fnv1a(source.data(), source.length())]=data;
+		pos+=frame_header+len;
+	}
+
+	if (fd>=0)
+		close(fd);
+	fd=::open(filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd<0)
+		throw std::runtime_error(filename+": "+strerror(errno));
+	if (debug)
+		std::cerr<<"Program cache "<<filename<<", "<<on_disk.size()<<" programs."<<std::endl;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <set>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include "bytecode.hpp"
+
+namespace loglang{
+	class ASTBase;
+
+	/**
+	 * @short A program text parsed and compiled, shared by all the programs with that text.
+	 *
+	 * Bytecode does not change when run, and the state is at each Program, so it can be shared.
+	 */
+	class CompiledProgram{
+	public:
+		std::shared_ptr<ASTBase> ast; // nullptr when loaded from the cache file
+		std::set<std::string> dependencies;
+		Bytecode bytecode;
+
+		/// Parses and compiles it. Throws on errors.
+		static std::shared_ptr<CompiledProgram> compile(const std::string &source);
+	};
+
+	/**
+	 * @short Compiled programs by a hash of their text, so each text is parsed only once.
+	 *
+	 * Rule sets are sent again whole at each deploy, and many rules only differ in the name. If a
+	 * file is open, compiled programs are also appended to it, and read back at the next start
+	 * instead of parsing them. The file is only a cache: entries that do not load, or whose
+	 * operands are out of their tables, are compiled again. The file version follows the
+	 * compiler output, so a new build starts a new file.
+	 *
+	 * Entries not used by any program are dropped when there are more than max_entries, and the
+	 * file keeps the newest max_entries when opened.
+	 */
+	class ProgramCache{
+		class Entry{
+		public:
+			std::string source;
+			std::shared_ptr<const CompiledProgram> compiled;
+		};
+		std::unordered_map<uint64_t, Entry> entries;
+		int fd=-1;
+		std::string disk; // The file contents when opened
+		std::unordered_map<uint64_t, std::string_view> on_disk; // Entries at disk, by hash
+		uint64_t _hits=0, _disk_hits=0, _misses=0;
+
+		std::shared_ptr<const CompiledProgram> load(std::string_view data, const std::string &source) const;
+		void append(const std::string &source, const CompiledProgram &compiled);
+	public:
+		size_t max_entries=1<<16;
+
+		ProgramCache(){}
+		ProgramCache(const ProgramCache &)=delete;
+		~ProgramCache();
+
+		/// Compiled program for the source, from memory, from the file, or compiled now. Throws on compile errors.
+		std::shared_ptr<const CompiledProgram> get(const std::string &source);
+		/// Reads the compiled programs at the file, and appends the new ones there. Throws on error.
+		void open(const std::string &filename);
+
+		uint64_t hits() const { return _hits; }
+		uint64_t disk_hits() const { return _disk_hits; }
+		uint64_t misses() const { return _misses; }
+	};
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+
+#include "regexset.hpp"
+
+using namespace loglang;
+
+void RegexSet::add(const std::string &pattern)
+{
+	Rule rule{pattern, std::regex(pattern), required_literal(pattern)};
+	for(auto &r: rules){
+		if (r.pattern==pattern){
+			r=std::move(rule);
+			dirty=true;
+			return;
+		}
+	}
+	rules.push_back(std::move(rule));
+	dirty=true;
+}
+
+void RegexSet::remove(const std::string &pattern)
+{
+	rules.erase( std::remove_if(std::begin(rules), std::end(rules), [&pattern](const Rule &r){ return r.pattern==pattern; }), std::end(rules) );
+	dirty=true;
+}
+
+void RegexSet::build()
+{
+	prefilter.clear();
+	literal_rule.clear();
+	always.clear();
+	for(uint32_t i=0;i<rules.size();i++){
+		if (rules[i].literal.empty())
+			always.push_back(i);
+		else{
+			prefilter.add(rules[i].literal);
+			literal_rule.push_back(i);
+		}
+	}
+	prefilter.build();
+	seen.assign(rules.size(), 0);
+	dirty=false;
+}
+
+bool RegexSet::match(std::string_view line, const match_t &f)
+{
+	if (rules.empty())
+		return false;
+	if (dirty)
+		build();
+	lines++;
+	candidates=always;
+	prefilter.scan(line, [this](uint32_t id){
+		auto rule=literal_rule[id];
+		if (seen[rule]!=lines){
+			seen[rule]=lines;
+			candidates.push_back(rule);
+		}
+	});
+	if (candidates.empty())
+		return false;
+	std::sort(std::begin(candidates), std::end(candidates));
+
+	bool matched=false;
+	std::cmatch m;
+	std::vector<std::string> captures;
+	for(auto i: candidates){
+		if (!std::regex_search(line.data(), line.data()+line.size(), m, rules[i].regex))
+			continue;
+		captures.clear();
+		for(auto &group: m)
+			captures.push_back(group.str());
+		matched=true;
+		f(rules[i].pattern, captures);
+	}
+	return matched;
+}
+
+/**
+ * Walks the top level atoms of the pattern keeping the current run of literal chars, and the
+ * longest one. Anything that is not a plain char ends the run: classes, groups, escapes as
+ * `\d`, `\x41` or `\0`, back references, anchors and `.`. A char made optional by `?`, `*` or
+ * `{0` is dropped, and one that may repeat is kept but ends the run. Top level alternatives have
+ * no common literal.
+ */
+std::string RegexSet::required_literal(const std::string &pattern)
+{
+	std::string best, current;
+	auto end_run=[&best, &current]{
+		if (current.length()>best.length())
+			best=current;
+		current.clear();
+	};
+	size_t i=0, n=pattern.length();
+	while (i<n){
+		bool literal=false;
+		char c=pattern[i];
+		if (c=='|')
+			return std::string();
+		if (c=='\\' && i+1<n){
+			c=pattern[i+1];
+			literal=!std::isalnum((unsigned char)c);
+			i+=2;
+			// The rest of the escape is not literal: \x41, \u0041, \cJ and back references as \12
+			size_t skip=(c=='x' ? 2 : c=='u' ? 4 : c=='c' ? 1 : 0);
+			for(;skip>0 && i<n && std::isalnum((unsigned char)pattern[i]);skip--)
+				i++;
+			if (c>='1' && c<='9'){
+				while (i<n && std::isdigit((unsigned char)pattern[i]))
+					i++;
+			}
+		}
+		else if (c=='['){ // Skip the class
+			i++;
+			if (i<n && pattern[i]=='^')
+				i++;
+			if (i<n && pattern[i]==']')
+				i++;
+			while (i<n && pattern[i]!=']'){
+				if (pattern[i]=='\\')
+					i++;
+				i++;
+			}
+			i++;
+		}
+		else if (c=='('){ // Skip the group
+			int depth=0;
+			for(;i<n;i++){
+				if (pattern[i]=='\\')
+					i++;
+				else if (pattern[i]=='(')
+					depth++;
+				else if (pattern[i]==')' && --depth==0)
+					break;
+			}
+			i++;
+		}
+		else if (c=='{'){ // Skip the repeat count
+			while (i<n && pattern[i]!='}')
+				i++;
+			i++;
+		}
+		else{
+			literal=(c!='.' && c!='^' && c!='$' && c!='*' && c!='+' && c!='?' && c!=')');
+			i++;
+		}
+
+		bool optional=false, repeats=false;
+		if (i<n){
+			auto q=pattern[i];
+			optional=(q=='?' || q=='*' || (q=='{' && i+1<n && pattern[i+1]=='0'));
+			repeats=(q=='+' || q=='{');
+		}
+		if (literal && !optional)
+			current+=c;
+		if (!literal || optional || repeats)
+			end_run();
+	}
+	end_run();
+	return best;
+}
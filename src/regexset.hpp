@@ -0,0 +1,72 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <regex>
+#include <functional>
+
+#include "ahocorasick.hpp"
+
+namespace loglang{
+	/**
+	 * @short The regexes of the regex rules, to find which ones match a line.
+	 *
+	 * Most patterns have some literal text that any match must contain, as `Log started: ` at
+	 * `/Log started: (.*)/`. The longest of each pattern goes to an AhoCorasick automaton, so
+	 * a line is scanned once to know the candidate regexes, and only those are run. Patterns
+	 * with no required literal, as `/^(\d+)$/`, are always candidates.
+	 */
+	class RegexSet{
+		class Rule{
+		public:
+			std::string pattern; // As written, between the slashes
+			std::regex regex;
+			std::string literal; // Required in any match, may be empty
+		};
+		std::vector<Rule> rules; // In definition order
+		AhoCorasick prefilter;
+		std::vector<uint32_t> literal_rule; // Rule of each prefilter pattern
+		std::vector<uint32_t> always; // Rules with no literal
+		std::vector<uint64_t> seen; // Line count when each rule was last a candidate
+		std::vector<uint32_t> candidates;
+		uint64_t lines=0;
+		bool dirty=false;
+
+		void build();
+	public:
+		using match_t = std::function<void (const std::string &pattern, const std::vector<std::string> &captures)>;
+
+		/// Adds or replaces the rule for this pattern. Throws std::regex_error if invalid.
+		void add(const std::string &pattern);
+		void remove(const std::string &pattern);
+		bool empty() const { return rules.empty(); }
+		size_t size() const { return rules.size(); }
+
+		/**
+		 * @short Calls f for each rule that matches the line, in definition order.
+		 *
+		 * Captures has the full match at 0 and then each group. Returns true if any matched.
+		 */
+		bool match(std::string_view line, const match_t &f);
+
+		/// Literal text that any match of the pattern must contain; empty if none found.
+		static std::string required_literal(const std::string &pattern);
+	};
+}
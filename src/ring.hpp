@@ -0,0 +1,99 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace loglang{
+	/**
+	 * @short Lock free single producer, single consumer ring buffer
+	 *
+	 * One thread may push and another pop at the same time, with no locks. Capacity is rounded up
+	 * to a power of two. Each side keeps a cached copy of the other side index, so the shared
+	 * indexes are only read when the ring looks full or empty.
+	 *
+	 * Also counts the pushed elements, the maximum occupancy seen by the producer and how many
+	 * times it found the ring full.
+	 */
+	template<typename T>
+	class SPSCRing{
+		std::vector<T> slots;
+		size_t mask;
+		alignas(64) std::atomic<size_t> head{0}; // Next to pop, written by consumer
+		size_t tail_cache=0; // Consumer copy of tail
+		alignas(64) std::atomic<size_t> tail{0}; // Next to push, written by producer
+		size_t head_cache=0; // Producer copy of head
+		std::atomic<uint64_t> _pushed{0};
+		std::atomic<size_t> _max_occupancy{0};
+		std::atomic<uint64_t> _full{0};
+	public:
+		explicit SPSCRing(size_t capacity){
+			size_t n=1;
+			while (n<capacity)
+				n<<=1;
+			slots.resize(n);
+			mask=n-1;
+		}
+		SPSCRing(const SPSCRing &) = delete;
+		SPSCRing &operator=(const SPSCRing &) = delete;
+
+		/// Producer side. Returns false, and keeps val, if full.
+		bool push(T &val){
+			auto t=tail.load(std::memory_order_relaxed);
+			if (t-head_cache>mask){
+				head_cache=head.load(std::memory_order_acquire);
+				if (t-head_cache>mask){
+					_full.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+			}
+			slots[t & mask]=std::move(val);
+			tail.store(t+1, std::memory_order_release);
+			_pushed.fetch_add(1, std::memory_order_relaxed);
+			// The cached head only overstates it, so the real one is read only when it may be a new maximum
+			if (t+1-head_cache>_max_occupancy.load(std::memory_order_relaxed)){
+				head_cache=head.load(std::memory_order_acquire);
+				if (t+1-head_cache>_max_occupancy.load(std::memory_order_relaxed))
+					_max_occupancy.store(t+1-head_cache, std::memory_order_relaxed);
+			}
+			return true;
+		}
+		/// Consumer side. Returns false if empty.
+		bool pop(T &val){
+			auto h=head.load(std::memory_order_relaxed);
+			if (h==tail_cache){
+				tail_cache=tail.load(std::memory_order_acquire);
+				if (h==tail_cache)
+					return false;
+			}
+			val=std::move(slots[h & mask]);
+			head.store(h+1, std::memory_order_release);
+			return true;
+		}
+
+		size_t capacity() const { return mask+1; }
+		/// Current elements; only approximate if the other side is working.
+		size_t size() const { return tail.load(std::memory_order_acquire)-head.load(std::memory_order_acquire); }
+		uint64_t pushed() const { return _pushed.load(std::memory_order_relaxed); }
+		size_t max_occupancy() const { return _max_occupancy.load(std::memory_order_relaxed); }
+		/// Times the producer found it full
+		uint64_t full_count() const { return _full.load(std::memory_order_relaxed); }
+	};
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "scheduler.hpp"
+#include "program.hpp"
+#include "symbol.hpp"
+#include "context.hpp"
+
+namespace loglang{
+	extern bool debug;
+}
+
+using namespace loglang;
+
+/**
+ * Longest path ranks, by Kahn's algorithm. When only programs on cycles are left, the first
+ * defined one is ranked as if its edges from the cycle did not exist.
+ */
+void Scheduler::rank(const std::unordered_map<std::string, std::shared_ptr<Program>> &programs)
+{
+	std::vector<Program*> progs;
+	for(auto &p: programs)
+		progs.push_back(p.second.get());
+	std::sort(std::begin(progs), std::end(progs), [](Program *a, Program *b){ return a->sequence<b->sequence; });
+
+	std::unordered_map<Program*, size_t> index;
+	for(size_t i=0;i<progs.size();i++){
+		index[progs[i]]=i;
+		progs[i]->rank=0;
+	}
+	std::vector<std::vector<size_t>> next(progs.size());
+	std::vector<size_t> indegree(progs.size());
+	for(size_t i=0;i<progs.size();i++){
+		for(auto sym: progs[i]->stores()){
+			for(auto &q: sym->programs()){
+				auto I=index.find(q.get());
+				if (I==std::end(index) || I->second==i)
+					continue;
+				auto &n=next[i];
+				if (std::find(std::begin(n), std::end(n), I->second)==std::end(n)){
+					n.push_back(I->second);
+					indegree[I->second]++;
+				}
+			}
+		}
+	}
+
+	// By index, which is the definition order
+	std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready;
+	for(size_t i=0;i<progs.size();i++)
+		if (indegree[i]==0)
+			ready.push(i);
+	std::vector<bool> done(progs.size());
+	size_t ndone=0, first_pending=0;
+	while (ndone<progs.size()){
+		if (ready.empty()){ // Cycle
+			while (done[first_pending])
+				first_pending++;
+			ready.push(first_pending);
+		}
+		auto i=ready.top();
+		ready.pop();
+		if (done[i])
+			continue;
+		done[i]=true;
+		ndone++;
+		for(auto j: next[i]){
+			if (done[j])
+				continue;
+			progs[j]->rank=std::max(progs[j]->rank, progs[i]->rank+1);
+			if (--indegree[j]==0)
+				ready.push(j);
+		}
+	}
+	ranks_dirty=false;
+
+	if (debug){
+		for(auto p: progs)
+			std::cerr<<"Rank "<<p->rank<<" "<<p->name()<<std::endl;
+	}
+}
+
+void Scheduler::schedule(const std::shared_ptr<Program> &program, Symbol &trigger)
+{
+	program->stats.trigger(&trigger);
+	if (program->queued || program->last_run==epoch)
+		return;
+	program->queued=true;
+	queue.push(Entry{program->rank, program->sequence, program, &trigger});
+}
+
+void Scheduler::run(Context &context)
+{
+	if (draining) // Programs are run by the outer drain
+		return;
+	draining=true;
+	while (!queue.empty()){
+		auto entry=queue.top();
+		queue.pop();
+		entry.program->queued=false;
+		if (entry.program->removed){ // While queued, as in a batch; the current definition runs, if it still depends on the trigger
+			auto next=entry.program->replacement;
+			while (next && next->removed) // Redefined again
+				next=next->replacement;
+			auto &deps=entry.trigger->programs();
+			if (next && std::find(std::begin(deps), std::end(deps), next)!=std::end(deps))
+				schedule(next, *entry.trigger);
+			continue;
+		}
+		entry.program->last_run=epoch;
+		context.percent_symbol().set(entry.trigger->name_value(), context);
+		entry.program->run(context, entry.trigger);
+		runs++;
+	}
+	epoch++;
+	draining=false;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+namespace loglang{
+	class Program;
+	class Symbol;
+	class Context;
+
+	/**
+	 * @short Runs the programs affected by symbol changes, in dependency order.
+	 *
+	 * Symbol changes only schedule the programs that depend on them; they run later, when the
+	 * queue is drained at the end of each input line. Programs are ranked by the rule graph, where
+	 * P → Q if P stores any symbol Q depends on, so all the programs that may change the
+	 * inputs of another run before it. Programs with the same rank run in definition order.
+	 *
+	 * Each program runs at most once per drain. A change by a later program on a cycle does not
+	 * run it again, so cycles can not run forever, and deep chains do not use the C++ stack.
+	 */
+	class Scheduler{
+		class Entry{
+		public:
+			uint32_t rank;
+			uint64_t sequence;
+			std::shared_ptr<Program> program;
+			Symbol *trigger;
+
+			bool operator>(const Entry &o) const{
+				return rank>o.rank || (rank==o.rank && sequence>o.sequence);
+			}
+		};
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+		uint64_t epoch=1;
+		bool ranks_dirty=false;
+		bool draining=false;
+		uint64_t runs=0;
+	public:
+		/// Programs changed, so ranks must be calculated again before next run.
+		void invalidate_ranks(){ ranks_dirty=true; }
+		bool needs_ranks() const { return ranks_dirty; }
+		void rank(const std::unordered_map<std::string, std::shared_ptr<Program>> &programs);
+
+		/// Program will run at next drain, with % set to the trigger, unless it already ran on this one.
+		void schedule(const std::shared_ptr<Program> &program, Symbol &trigger);
+		/// Runs all scheduled programs, and the ones they schedule, in order.
+		void run(Context &context);
+		bool pending() const { return !queue.empty(); }
+		/// Programs run since the start.
+		uint64_t programs_run() const { return runs; }
+	};
+}
@@ -0,0 +1,592 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "sharded.hpp"
+#include "parser.hpp"
+#include "bytecode.hpp"
+#include "glob.hpp"
+
+namespace loglang{
+	extern bool debug;
+}
+
+using namespace loglang;
+
+static const size_t shard_ring_size=4096;
+
+namespace{
+	bool writes_register(const Instr &in){
+		switch(in.op){
+			case Instr::NOP: case Instr::STORE: case Instr::JMP: case Instr::JF: case Instr::EDGE: case Instr::AT:
+				return false;
+			default:
+				return true;
+		}
+	}
+
+	/**
+	 * Globs the print calls read, from the constant string each is called with, as
+	 * print("disk.*"). If some argument is computed at run time it may be any symbol, so "*".
+	 */
+	std::set<std::string> print_globs(const Bytecode &bc){
+		std::set<std::string> globs;
+		std::set<size_t> targets; // Of jumps; another path may set the argument
+		for(auto &in: bc.code){
+			if (in.op==Instr::JMP || in.op==Instr::JF || in.op==Instr::EDGE || in.op==Instr::AT)
+				targets.insert(in.a);
+		}
+		for(size_t i=0;i<bc.code.size();i++){
+			auto &call=bc.code[i];
+			if (call.op!=Instr::CALL || bc.functions[call.a]!="print" || call.b==0)
+				continue;
+			const Instr *arg=nullptr;
+			for(size_t j=i;j-->0 && !targets.count(j+1);){
+				if (writes_register(bc.code[j]) && bc.code[j].dst==call.dst){
+					arg=&bc.code[j];
+					break;
+				}
+			}
+			if (arg && arg->op==Instr::CONST && bc.constants[arg->a].type()==any::STRING)
+				globs.insert(bc.constants[arg->a].to_string());
+			else
+				globs.insert("*");
+		}
+		return globs;
+	}
+}
+
+ShardedContext::ShardedContext(unsigned nshards)
+{
+	if (nshards<1)
+		nshards=1;
+	auto ncpus=std::thread::hardware_concurrency();
+	for(unsigned i=0;i<nshards;i++){
+		auto shard=std::unique_ptr<Shard>(new Shard());
+		for(unsigned j=0;j<=nshards;j++)
+			shard->inbox.emplace_back(new SPSCRing<ShardMessage>(shard_ring_size));
+		shard->outbox.resize(nshards);
+		shard->wakefd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (shard->wakefd<0)
+			throw std::runtime_error(std::string("Could not create wake up descriptor: ")+strerror(errno));
+		shard->context.set_output([this](const std::string &str){
+			std::lock_guard<std::mutex> lock(output_mutex);
+			std::cout<<str<<std::endl;
+		});
+		shards.push_back(std::move(shard));
+	}
+	last_posted.resize(nshards);
+	required.resize(nshards, std::vector<uint64_t>(nshards));
+	exporters.resize(nshards);
+	upstream.resize(nshards);
+	for(unsigned i=0;i<nshards;i++){
+		shards[i]->thread=std::thread([this, i](){ run_shard(i); });
+		if (ncpus>1){ // Pin each shard to a core
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(i%ncpus, &cpus);
+			pthread_setaffinity_np(shards[i]->thread.native_handle(), sizeof(cpus), &cpus);
+		}
+	}
+}
+
+ShardedContext::~ShardedContext()
+{
+	wait_idle();
+	stopping=true;
+	for(size_t i=0;i<shards.size();i++){
+		wake(i);
+		shards[i]->thread.join();
+		close(shards[i]->wakefd);
+	}
+}
+
+uint16_t ShardedContext::owner(std::string_view key) const
+{
+	auto segment=key.substr(0, key.find('.'));
+	return std::hash<std::string_view>()(segment) % shards.size();
+}
+
+int ShardedContext::glob_owner(std::string_view glob) const
+{
+	auto dot=glob.find('.');
+	auto segment=glob.substr(0, dot);
+	if (is_glob(segment))
+		return shards.size()==1 ? 0 : -1;
+	return owner(segment);
+}
+
+void ShardedContext::feed_secure(std::string_view data)
+{
+	feed(LineScanner::split(data.data(), data.length()), true);
+}
+
+void ShardedContext::feed(std::string_view data)
+{
+	feed(LineScanner::split(data.data(), data.length()), false);
+}
+
+/// Lines go to other threads, so they are copied to a record.
+void ShardedContext::feed(const LineSpan &span, bool is_secure)
+{
+	FeedRecord record;
+	if (is_secure ? Context::parse_secure(span, record) : Context::parse(span, record))
+		feed(std::move(record));
+}
+
+void ShardedContext::feed(FeedRecord record)
+{
+	if (record.is_program){
+		define_program(record.key);
+		return;
+	}
+	if (!record.line.empty() && regex_rules.match(record.line, [this](const std::string &pattern, const std::vector<std::string> &captures){
+			ShardMessage msg;
+			msg.kind=ShardMessage::MATCH;
+			msg.key=pattern;
+			msg.captures=captures;
+			post(regex_shards[pattern], std::move(msg));
+		}))
+		return;
+	auto to=owner(record.key);
+	ShardMessage msg;
+	msg.kind=ShardMessage::DATA;
+	msg.key=std::move(record.key);
+	msg.value=std::move(record.value);
+	post(to, std::move(msg));
+}
+
+/**
+ * The program is compiled here just to know the symbols it uses, and then sent to its shard. Its
+ * shard is the owner of most of the dependencies, so most of its triggers are local.
+ */
+void ShardedContext::define_program(const std::string &line)
+{
+	std::string name, code;
+	if (!Context::split_program(line, name, code)){
+		std::cerr<<"Error compiling: regex rule with no closing slash: "<<line<<std::endl;
+		return;
+	}
+	bool is_regex=(name[0]=='/');
+	std::set<std::string> dependencies;
+	Bytecode bc;
+	if (!code.empty()){
+		try{
+			auto ast=parse_program(code);
+			dependencies=ast->dependencies();
+			compile(*ast, bc);
+			if (is_regex)
+				regex_rules.add(Context::regex_pattern(name));
+		}
+		catch(std::exception &excp){
+			std::cerr<<"Error compiling: "<<excp.what()<<std::endl;
+			return;
+		}
+	}
+
+	std::map<uint16_t, int> votes;
+	for(auto &dep: dependencies){
+		auto o=is_glob(dep) ? glob_owner(dep) : owner(dep);
+		if (o>=0)
+			votes[o]++;
+	}
+	uint16_t home=0;
+	int best=0;
+	for(auto &v: votes){
+		if (v.second>best){
+			home=v.first;
+			best=v.second;
+		}
+	}
+
+	// Program shard gets the foreign symbols it reads, and the owners get what it stores.
+	std::set<std::string> stores;
+	for(auto &in: bc.code){
+		if (in.op==Instr::STORE)
+			stores.insert(bc.symbols[in.a]);
+	}
+	std::set<Export> wanted;
+	std::set<std::string> used(std::begin(dependencies), std::end(dependencies));
+	used.insert(std::begin(bc.symbols), std::end(bc.symbols));
+	used.insert(std::begin(bc.globs), std::end(bc.globs));
+	used.insert(std::begin(bc.aggregates), std::end(bc.aggregates));
+	auto printed=print_globs(bc);
+	used.insert(std::begin(printed), std::end(printed));
+	for(auto &sym: used){
+		if (sym=="%")
+			continue;
+		if (!is_glob(sym)){
+			auto o=owner(sym);
+			if (o==home)
+				continue;
+			wanted.emplace(o, home, sym);
+			if (stores.count(sym))
+				wanted.emplace(home, o, sym);
+			continue;
+		}
+		auto o=glob_owner(sym);
+		for(uint16_t i=0;i<shards.size();i++){
+			if (i!=home && (o<0 || o==i))
+				wanted.emplace(i, home, sym);
+		}
+	}
+	update_exports(name, std::move(wanted));
+
+	auto I=program_shards.find(name);
+	if (I!=std::end(program_shards) && (I->second!=home || code.empty())){ // Remove where it was
+		ShardMessage msg;
+		msg.kind=ShardMessage::PROGRAM;
+		msg.key=name;
+		post(I->second, std::move(msg));
+		program_shards.erase(I);
+	}
+	if (is_regex){
+		if (code.empty())
+			regex_rules.remove(Context::regex_pattern(name));
+		else
+			regex_shards[Context::regex_pattern(name)]=home;
+	}
+	if (code.empty())
+		return;
+	program_shards[name]=home;
+
+	ShardMessage msg;
+	msg.kind=ShardMessage::PROGRAM;
+	msg.key=line;
+	post(home, std::move(msg));
+	if (debug){
+		std::cerr<<"Program "<<name<<" at shard "<<home<<std::endl;
+	}
+}
+
+/**
+ * Exports are counted by the programs that need them, so one is only sent once, and stopped
+ * when the last program that needs it is removed or redefined without it. The new ones are sent
+ * before stopping the old, so one both need is never stopped.
+ */
+void ShardedContext::update_exports(const std::string &name, std::set<Export> wanted)
+{
+	auto send_export=[this](ShardMessage::kind_t kind, const Export &e){
+		ShardMessage msg;
+		msg.kind=kind;
+		msg.shard=std::get<1>(e);
+		msg.key=std::get<2>(e);
+		post(std::get<0>(e), std::move(msg));
+		if (debug){
+			std::cerr<<(kind==ShardMessage::EXPORT ? "Export " : "Unexport ")<<std::get<2>(e)<<" from shard "<<std::get<0>(e)<<" to "<<std::get<1>(e)<<std::endl;
+		}
+	};
+	auto &old=program_exports[name];
+	bool changed=false;
+	for(auto &e: wanted){
+		if (!old.count(e) && export_refs[e]++==0){
+			send_export(ShardMessage::EXPORT, e);
+			changed=true;
+		}
+	}
+	for(auto &e: old){
+		if (!wanted.count(e) && --export_refs[e]==0){
+			send_export(ShardMessage::UNEXPORT, e);
+			export_refs.erase(e);
+			changed=true;
+		}
+	}
+	if (wanted.empty())
+		program_exports.erase(name);
+	else
+		old=std::move(wanted);
+	if (!changed)
+		return;
+	std::vector<std::set<uint16_t>> now(shards.size());
+	for(auto &r: export_refs)
+		now[std::get<1>(r.first)].insert(std::get<0>(r.first));
+	if (now!=exporters){
+		exporters=std::move(now);
+		update_upstream();
+	}
+}
+
+/**
+ * The changes of a line at a shard go to the shards it exports to, and from them maybe further.
+ * Each of those must have the changes of the lines before from all their exporters, so the line
+ * waits for all of them.
+ */
+void ShardedContext::update_upstream()
+{
+	auto nshards=shards.size();
+	for(uint16_t n=0;n<nshards;n++){
+		std::vector<bool> reached(nshards), waits(nshards);
+		std::vector<uint16_t> stack{n};
+		reached[n]=true;
+		while (!stack.empty()){
+			auto d=stack.back();
+			stack.pop_back();
+			for(auto e: exporters[d]){
+				waits[e]=true;
+			}
+			for(uint16_t t=0;t<nshards;t++){ // Shards d exports to
+				if (!reached[t] && exporters[t].count(d)){
+					reached[t]=true;
+					stack.push_back(t);
+				}
+			}
+		}
+		upstream[n].clear();
+		for(uint16_t e=0;e<nshards;e++){
+			if (waits[e] && e!=n)
+				upstream[n].push_back(e);
+		}
+	}
+}
+
+void ShardedContext::process(uint16_t n, uint16_t from, ShardMessage &msg)
+{
+	auto &shard=*shards[n];
+	auto &context=shard.context;
+	shard.current_seq=msg.seq;
+	switch(msg.kind){
+		case ShardMessage::DATA:{
+			FeedRecord record;
+			record.key=msg.key;
+			record.value=msg.value;
+			shard.applying=&msg;
+			shard.applying_from=from;
+			context.feed(std::move(record));
+			shard.applying=nullptr;
+		}
+			break;
+		case ShardMessage::PROGRAM:
+			context.feed_secure(std::move(msg.key));
+			break;
+		case ShardMessage::MATCH:
+			context.feed_match(msg.key, msg.captures);
+			break;
+		case ShardMessage::EXPORT:{
+			auto to=msg.shard;
+			auto send_value=[this, n, to](Symbol &sym){
+				// The sender already has it; if it changed again meanwhile, this old value would overwrite it.
+				auto applying=shards[n]->applying;
+				if (applying && shards[n]->applying_from==to && applying->key==sym.name() && applying->value==sym.get())
+					return;
+				ShardMessage data;
+				data.kind=ShardMessage::DATA;
+				data.key=sym.name();
+				data.value=sym.get();
+				send(n, to, std::move(data));
+			};
+			shard.exports[{msg.key, to}]=context.watch(msg.key, send_value);
+			for(auto sym: context.symboltable_filter(msg.key)) // Current values
+				send_value(*sym);
+		}
+			break;
+		case ShardMessage::UNEXPORT:{
+			auto I=shard.exports.find({msg.key, msg.shard});
+			if (I!=std::end(shard.exports)){
+				context.unwatch(msg.key, I->second);
+				shard.exports.erase(I);
+			}
+		}
+			break;
+	}
+}
+
+/**
+ * Messages from all the rings are sorted by the line that caused them. A second pass gets also
+ * the messages pushed before the ones of the first, as a shard only sends the changes of a line
+ * after the ones of the lines before from the shards it waited for.
+ */
+bool ShardedContext::collect_peers(uint16_t n)
+{
+	auto &shard=*shards[n];
+	auto &incoming=shard.incoming;
+	auto size=incoming.size();
+	for(int pass=0;pass<2;pass++){
+		for(uint16_t from=0;from<shards.size();from++){
+			auto &ring=*shard.inbox[from];
+			ShardMessage msg;
+			while (ring.pop(msg))
+				incoming.emplace_back(from, std::move(msg));
+		}
+	}
+	if (incoming.size()==size)
+		return false;
+	std::stable_sort(std::begin(incoming), std::end(incoming), [](const auto &a, const auto &b){
+		return a.second.seq<b.second.seq;
+	});
+	return true;
+}
+
+void ShardedContext::apply_peers(uint16_t n, uint64_t limit)
+{
+	auto &incoming=shards[n]->incoming;
+	size_t i=0;
+	for(;i<incoming.size() && incoming[i].second.seq<limit;i++){
+		try{
+			process(n, incoming[i].first, incoming[i].second);
+		}
+		catch(const std::exception &e){
+			std::cerr<<"Shard "<<n<<": "<<e.what()<<std::endl;
+		}
+		in_flight--;
+	}
+	incoming.erase(std::begin(incoming), std::begin(incoming)+i);
+}
+
+void ShardedContext::publish(uint16_t n)
+{
+	if (send_pending(n))
+		shards[n]->done_seq.store(shards[n]->last_seq, std::memory_order_release);
+}
+
+/**
+ * Messages from the feeder and from other shards are applied in line order. Any line from the
+ * feeder before a change from other shard is already at the ring when the change arrives, so
+ * the peers are collected first.
+ */
+void ShardedContext::run_shard(uint16_t n)
+{
+	auto &shard=*shards[n];
+	auto &feeder=*shard.inbox.back();
+	struct pollfd pfd;
+	pfd.fd=shard.wakefd;
+	pfd.events=POLLIN;
+	while (true){
+		bool work=collect_peers(n);
+		if (!shard.has_next)
+			shard.has_next=feeder.pop(shard.next);
+		if (!shard.has_next){
+			apply_peers(n, UINT64_MAX);
+			publish(n);
+		}
+		else{
+			auto &msg=shard.next;
+			apply_peers(n, msg.seq);
+			for(auto &w: msg.wait_for){
+				while (shards[w.first]->done_seq.load(std::memory_order_acquire)<w.second){
+					collect_peers(n);
+					apply_peers(n, msg.seq);
+					publish(n);
+					std::this_thread::yield();
+				}
+			}
+			if (!msg.wait_for.empty()){ // Their changes are at the rings now
+				collect_peers(n);
+				apply_peers(n, msg.seq);
+			}
+			try{
+				process(n, shards.size(), msg);
+			}
+			catch(const std::exception &e){
+				std::cerr<<"Shard "<<n<<": "<<e.what()<<std::endl;
+			}
+			shard.last_seq=msg.seq;
+			shard.has_next=false;
+			in_flight--;
+			publish(n);
+			work=true;
+		}
+		if (work)
+			continue;
+		bool all_sent=shard.done_seq.load(std::memory_order_relaxed)==shard.last_seq;
+		if (stopping && all_sent)
+			break;
+		if (poll(&pfd, 1, all_sent ? 100 : 1)>0){
+			uint64_t count;
+			if (read(shard.wakefd, &count, sizeof(count))<0 && errno!=EAGAIN)
+				perror("read");
+		}
+	}
+}
+
+void ShardedContext::send(uint16_t from, uint16_t to, ShardMessage msg)
+{
+	in_flight++;
+	msg.seq=shards[from]->current_seq;
+	shards[from]->outbox[to].push_back(std::move(msg));
+}
+
+bool ShardedContext::send_pending(uint16_t from)
+{
+	bool all_sent=true;
+	auto &outbox=shards[from]->outbox;
+	for(uint16_t to=0;to<outbox.size();to++){
+		auto &pending=outbox[to];
+		if (pending.empty())
+			continue;
+		auto &ring=*shards[to]->inbox[from];
+		size_t i=0;
+		while (i<pending.size() && ring.push(pending[i]))
+			i++;
+		pending.erase(std::begin(pending), std::begin(pending)+i);
+		all_sent=all_sent && pending.empty();
+		if (i>0)
+			wake(to);
+	}
+	return all_sent;
+}
+
+void ShardedContext::post(uint16_t to, ShardMessage msg)
+{
+	msg.seq=++next_seq;
+	for(auto from: upstream[to]){
+		if (last_posted[from]>required[to][from]){
+			msg.wait_for.emplace_back(from, last_posted[from]);
+			required[to][from]=last_posted[from];
+		}
+	}
+	last_posted[to]=msg.seq;
+	in_flight++;
+	auto &ring=*shards[to]->inbox.back();
+	while (!ring.push(msg)){
+		wake(to);
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	wake(to);
+}
+
+void ShardedContext::wake(uint16_t to)
+{
+	uint64_t one=1;
+	if (write(shards[to]->wakefd, &one, sizeof(one))<0 && errno!=EAGAIN)
+		perror("wake");
+}
+
+void ShardedContext::wait_idle()
+{
+	while (in_flight.load()>0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void ShardedContext::debug_values()
+{
+	wait_idle();
+	for(uint16_t i=0;i<shards.size();i++){
+		shards[i]->context.debug_values([this, i](const std::string &name){
+			return name!="%" && owner(name)==i;
+		});
+	}
+}
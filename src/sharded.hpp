@@ -0,0 +1,158 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <set>
+#include <tuple>
+
+#include "context.hpp"
+#include "ring.hpp"
+
+namespace loglang{
+	/**
+	 * @short Message to a shard
+	 *
+	 * DATA sets key to value, PROGRAM defines the program at key (a full `:name code` line),
+	 * EXPORT asks to send all changes of symbols matching the key glob to the given shard,
+	 * UNEXPORT stops it, and MATCH runs the regex rule of the key pattern with the captures.
+	 */
+	class ShardMessage{
+	public:
+		enum kind_t : uint8_t{
+			DATA,
+			PROGRAM,
+			EXPORT,
+			UNEXPORT,
+			MATCH
+		};
+		kind_t kind=DATA;
+		uint16_t shard=0;
+		std::string key;
+		any value;
+		std::vector<std::string> captures;
+		uint64_t seq=0; // Input line number, or the one that caused it
+		std::vector<std::pair<uint16_t, uint64_t>> wait_for; // Shards that must process up to that line before this one
+	};
+
+	/**
+	 * @short Symbols and programs partitioned among many contexts, each at its own thread.
+	 *
+	 * Each symbol is owned by a shard, chosen by the hash of its first dotted segment, so all of
+	 * `disk.*` is at the same shard. Each program runs at the shard that owns most of its
+	 * dependencies. Symbols a program uses that are owned by other shards are mirrored: the
+	 * owner exports each change to the program shard, and stores by the program to them are
+	 * sent back to the owner.
+	 *
+	 * Input lines are numbered, and changes sent between shards keep the number of the line that
+	 * caused them, so they are applied in input order. A line sent to a shard also says, for each
+	 * shard whose changes may reach the same places and got lines since, up to which line it must
+	 * have processed and sent before this line is applied. So a rule always sees foreign values
+	 * at least as recent as the line that triggered it, as with a single context.
+	 *
+	 * Shards talk only by messages in SPSC rings, one per sender and receiver; messages that do
+	 * not fit are kept by the sender and sent later, and waiting shards keep processing the
+	 * messages from other shards, so shards never block each other.
+	 *
+	 * Regex rules are matched by the feeder, and placed as programs.
+	 *
+	 * Batch windows are not supported, rules run after each line at each shard.
+	 */
+	class ShardedContext : public FeedTarget{
+		class Shard{
+		public:
+			Context context;
+			std::vector<std::unique_ptr<SPSCRing<ShardMessage>>> inbox; // From each shard, and last from the feeder
+			std::vector<std::vector<ShardMessage>> outbox; // To each shard, if did not fit in its ring
+			int wakefd=-1;
+			std::thread thread;
+			const ShardMessage *applying=nullptr; // DATA being set, not to echo it back
+			uint16_t applying_from=0;
+			uint64_t last_seq=0; // Last feeder message processed
+			uint64_t current_seq=0; // Of the message being processed, for the ones it sends
+			std::vector<std::pair<uint16_t, ShardMessage>> incoming; // From other shards, sorted by line
+			ShardMessage next; // From the feeder, waiting for the lines before
+			bool has_next=false;
+			std::atomic<uint64_t> done_seq{0}; // Feeder messages processed, and their messages to others sent
+			std::map<std::pair<std::string, uint16_t>, const watcher_t*> exports; // By glob and shard, to unwatch
+		};
+		/// A glob one shard sends to another, for some program.
+		using Export=std::tuple<uint16_t, uint16_t, std::string>; // From, to, glob
+		std::vector<std::unique_ptr<Shard>> shards;
+		std::atomic<int64_t> in_flight{0}; // Messages sent and not processed yet
+		std::atomic<bool> stopping{false};
+		std::mutex output_mutex;
+		std::map<std::string, uint16_t> program_shards; // Where each program was sent, to remove it
+		RegexSet regex_rules; // Lines are matched here, and only the rule runs at its shard
+		std::map<std::string, uint16_t> regex_shards; // By pattern
+		// Feeder thread state, to keep the order between shards
+		uint64_t next_seq=0;
+		std::vector<uint64_t> last_posted; // Per shard
+		std::vector<std::vector<uint64_t>> required; // [to][from] last seq of from that to was told to wait for
+		std::map<std::string, std::set<Export>> program_exports; // Per program, to remove them when redefined
+		std::map<Export, unsigned> export_refs; // Programs that need each export
+		std::vector<std::set<uint16_t>> exporters; // Per shard, the shards that send it changes
+		std::vector<std::vector<uint16_t>> upstream; // Per shard, all the shards its changes may wait for
+
+		void run_shard(uint16_t n);
+		/// Moves the messages from other shards to incoming. Returns true if any.
+		bool collect_peers(uint16_t n);
+		/// Processes the incoming messages from lines before `limit`.
+		void apply_peers(uint16_t n, uint64_t limit);
+		/// Sends pending messages, and if all sent marks the feeder messages processed so far as done.
+		void publish(uint16_t n);
+		void process(uint16_t n, uint16_t from, ShardMessage &msg);
+		/// From shard `from` thread
+		void send(uint16_t from, uint16_t to, ShardMessage msg);
+		/// Pushes pending outbox messages. Returns true if all were pushed.
+		bool send_pending(uint16_t from);
+		/// From the feeder thread; waits while the ring is full.
+		void post(uint16_t to, ShardMessage msg);
+		void wake(uint16_t to);
+		void define_program(const std::string &line);
+		/// Sends the exports the program needs now and not before, and stops the ones no program needs.
+		void update_exports(const std::string &name, std::set<Export> wanted);
+		void update_upstream();
+	public:
+		ShardedContext(unsigned nshards);
+		~ShardedContext();
+
+		/// Shard that owns the symbol
+		uint16_t owner(std::string_view key) const;
+		/// Shard that owns all the symbols the glob may match, or -1 if many.
+		int glob_owner(std::string_view glob) const;
+
+		void feed_secure(std::string_view data) override;
+		void feed(std::string_view data) override;
+		void feed(const LineSpan &span, bool is_secure) override;
+		void feed(FeedRecord record) override;
+		void flush() override {}
+		int flush_expired() override { return -1; }
+
+		/// Waits until all the sent messages are processed.
+		void wait_idle();
+		/// Shows the values of each shard own symbols.
+		void debug_values();
+	};
+}
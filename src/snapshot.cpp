@@ -0,0 +1,155 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "context.hpp"
+#include "program.hpp"
+#include "binary.hpp"
+#include "changelog.hpp"
+#include "utils.hpp"
+
+namespace loglang{
+	extern bool debug;
+}
+
+using namespace loglang;
+
+/*
+ * Layout, all in native byte order, as it is only read back at the same host:
+ *
+ *   magic[8] version:u32
+ *   log_segment:u64  first change log segment with changes after it; not at version 1
+ *   nsymbols:u64  { name:str value }*
+ *   nprograms:u64 { name:str source:str nstate:u32 value* }*   in definition order
+ *   checksum:u64  FNV-1a of all the previous bytes
+ *
+ * str and values as BinaryWriter writes them, not compact.
+ */
+namespace{
+	const char magic[8]={'L','O','G','L','S','N','A','P'};
+	const uint32_t version=2;
+}
+
+void Context::save_snapshot(const std::string &filename)
+{
+	if (_change_log)
+		_change_log->rotate(); // Changes from now on go to a segment after the snapshot
+	BinaryWriter w;
+	w.buffer.append(magic, sizeof(magic));
+	w.put(version);
+	w.put(uint64_t(_change_log ? _change_log->segment() : 0));
+
+	w.put(uint64_t(sorted_symbols.size()));
+	for(auto &pair: sorted_symbols){
+		w.put_str(pair.first);
+		w.put_value(pair.second->get());
+	}
+
+	std::vector<const Program*> all;
+	for(auto &pair: programs)
+		all.push_back(pair.second.get());
+	for(auto &pair: regex_programs)
+		all.push_back(pair.second.get());
+	std::sort(std::begin(all), std::end(all), [](const Program *a, const Program *b){ return a->sequence<b->sequence; });
+	w.put(uint64_t(all.size()));
+	for(auto prog: all){
+		w.put_str(prog->name());
+		w.put_str(prog->source());
+		auto &state=prog->vm_state();
+		w.put(uint32_t(state.size()));
+		for(auto &v: state)
+			w.put_value(v);
+	}
+
+	w.put(fnv1a(w.buffer.data(), w.buffer.size()));
+	write_file_synced(filename, w.buffer);
+	if (_change_log)
+		_change_log->remove_before(_change_log->segment());
+	if (debug)
+		std::cerr<<"Snapshot written to "<<filename<<", "<<sorted_symbols.size()<<" symbols, "<<all.size()<<" programs, "<<w.buffer.size()<<" bytes."<<std::endl;
+}
+
+bool Context::load_snapshot(const std::string &filename, uint64_t *log_segment)
+{
+	int fd=open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd<0){
+		if (errno==ENOENT)
+			return false;
+		throw std::runtime_error(filename+": "+strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st)<0 || st.st_size<off_t(sizeof(magic)+sizeof(uint64_t))){
+		close(fd);
+		throw std::runtime_error(filename+": Not a snapshot");
+	}
+	size_t size=st.st_size;
+	auto map=(const char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map==MAP_FAILED)
+		throw std::runtime_error(filename+": "+strerror(errno));
+
+	try{
+		uint64_t checksum;
+		memcpy(&checksum, map+size-sizeof(checksum), sizeof(checksum));
+		if (memcmp(map, magic, sizeof(magic))!=0 || fnv1a(map, size-sizeof(checksum))!=checksum)
+			throw std::runtime_error("Not a snapshot, or corrupt");
+		BinaryReader r(map+sizeof(magic), size-sizeof(magic)-sizeof(checksum));
+		auto file_version=r.get<uint32_t>();
+		if (file_version<1 || file_version>version)
+			throw std::runtime_error("Unknown snapshot version");
+		uint64_t segment=(file_version>=2) ? r.get<uint64_t>() : 0;
+		if (log_segment)
+			*log_segment=segment;
+
+		auto nsymbols=r.get<uint64_t>();
+		for(uint64_t i=0;i<nsymbols;i++){
+			auto name=r.get_str();
+			auto value=r.get_value();
+			get_value(name).restore(std::move(value));
+		}
+
+		auto nprograms=r.get<uint64_t>();
+		for(uint64_t i=0;i<nprograms;i++){
+			std::string name(r.get_str());
+			std::string source(r.get_str());
+			auto nstate=r.get<uint32_t>();
+			std::vector<any> state;
+			for(uint32_t s=0;s<nstate;s++)
+				state.push_back(r.get_value());
+			define_program(name+" "+source);
+			auto prog=find_program(name);
+			if (prog && prog->source()==source && !prog->restore_state(std::move(state)))
+				std::cerr<<filename<<": State of "<<name<<" does not fit, starts empty."<<std::endl;
+		}
+		if (debug)
+			std::cerr<<"Snapshot loaded from "<<filename<<", "<<nsymbols<<" symbols, "<<nprograms<<" programs."<<std::endl;
+	}
+	catch(const std::exception &e){
+		munmap((void*)map, size);
+		throw std::runtime_error(filename+": "+e.what());
+	}
+	munmap((void*)map, size);
+	return true;
+}
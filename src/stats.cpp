@@ -0,0 +1,37 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+
+#include "stats.hpp"
+
+using namespace loglang;
+
+namespace{
+	using clock=std::chrono::steady_clock;
+	const uint64_t start_ticks=ticks();
+	const clock::time_point start_time=clock::now();
+}
+
+double loglang::ticks_per_ns()
+{
+	auto ns=std::chrono::duration<double, std::nano>(clock::now()-start_time).count();
+	if (ns<1e6){ // Too short to tell; wait a bit
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		ns=std::chrono::duration<double, std::nano>(clock::now()-start_time).count();
+	}
+	return double(ticks()-start_ticks)/ns;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace loglang{
+	class Symbol;
+
+	/**
+	 * @short Cheap timestamps, in CPU ticks where available.
+	 *
+	 * Reading the TSC is a few ns, against some tens for the clock, so programs can be timed
+	 * always. Use ticks_per_ns to convert.
+	 */
+	inline uint64_t ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+	/// Measured against the steady clock since the first call, so better later on.
+	double ticks_per_ns();
+
+	/**
+	 * @short Execution counters of a program, kept always.
+	 *
+	 * The most frequent trigger symbols are found as Misra-Gries does, with a few slots: a symbol
+	 * that triggers more than a fifth of the times is sure to be at some slot, and the count is
+	 * a lower bound.
+	 */
+	class ProgramStats{
+	public:
+		class TriggerCount{
+		public:
+			Symbol *symbol=nullptr;
+			uint64_t count=0;
+		};
+		uint64_t triggered=0; // Changes of its dependencies
+		uint64_t runs=0;
+		uint64_t no_change=0; // Runs that did not change any symbol
+		uint64_t errors=0;
+		uint64_t writes=0; // Symbols changed
+		uint64_t total_ticks=0;
+		uint64_t max_ticks=0;
+		std::array<TriggerCount, 4> triggers;
+
+		void trigger(Symbol *symbol){
+			triggered++;
+			for(auto &t: triggers){
+				if (t.symbol==symbol){
+					t.count++;
+					return;
+				}
+			}
+			for(auto &t: triggers){
+				if (t.count==0){
+					t.symbol=symbol;
+					t.count=1;
+					return;
+				}
+			}
+			for(auto &t: triggers)
+				t.count--;
+		}
+		void add_run(uint64_t elapsed, uint64_t changes){
+			runs++;
+			writes+=changes;
+			if (changes==0)
+				no_change++;
+			total_ticks+=elapsed;
+			if (elapsed>max_ticks)
+				max_ticks=elapsed;
+		}
+		const TriggerCount &top_trigger() const{
+			auto *best=&triggers[0];
+			for(auto &t: triggers)
+				if (t.count>best->count)
+					best=&t;
+			return *best;
+		}
+	};
+}
@@ -19,10 +19,11 @@
 #include "symbol.hpp"
 #include "program.hpp"
 #include "context.hpp"
+#include "aggregate.hpp"
 
 using namespace loglang;
 
-Symbol::Symbol(std::string name) : _name(std::move(name))
+Symbol::Symbol(std::string name) : _name(std::move(name)), _name_value(to_any(_name))
 {
 
 }
@@ -38,20 +39,42 @@ void Symbol::remove_program(std::shared_ptr< Program > _at_modify)
 	at_modify.erase( std::remove(std::begin(at_modify), std::end(at_modify), _at_modify), std::end(at_modify));
 }
 
+void Symbol::remove_watcher(const watcher_t *watcher)
+{
+	watchers.erase( std::remove(std::begin(watchers), std::end(watchers), watcher), std::end(watchers));
+}
+
+void Symbol::add_aggregate(GlobAggregate *aggregate)
+{
+	aggregates.push_back(aggregate);
+	aggregate->add_member(this);
+}
+
 const loglang::any &Symbol::get() const
 {
 	return val;
 }
 
+void Symbol::restore(any value)
+{
+	for(auto aggregate: aggregates)
+		aggregate->update(val, value);
+	val=std::move(value);
+}
+
 void Symbol::set(any new_val, Context &context)
 {
 	if (val==new_val) // Ignore no changes.
 		return; 
+	for(auto aggregate: aggregates)
+		aggregate->update(val, new_val);
 	val=std::move(new_val);
+	context.count_change(*this);
 // 	context.output(name, value);
 	if (_name=="%") // Prevent recursion.
 		return;
-	context.get_value("%").set(to_any(_name), context);
-	for(auto program: at_modify)
-		program->run(context);
+	for(auto watcher: watchers)
+		(*watcher)(*this);
+	for(auto &program: at_modify)
+		context.schedule(program, *this);
 }
@@ -20,24 +20,39 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <functional>
 
 #include "value.hpp"
 
 namespace loglang{
 	class Program;
 	class Context;
+	class GlobAggregate;
+	class Symbol;
+	
+	using watcher_t = std::function<void (Symbol &)>;
 	
 	class Symbol{
 		std::vector<std::shared_ptr<Program>> at_modify;
 		loglang::any val;
 		std::string _name;
+		loglang::any _name_value; // Name as a value, to set % without allocations
+		std::vector<GlobAggregate*> aggregates; // That this symbol is member of
+		std::vector<const watcher_t*> watchers; // Owned by the context
 	public:
 		Symbol(std::string name);
 		void run_at_modify(std::shared_ptr<Program> at_modify);
 		void remove_program(std::shared_ptr<Program> at_modify);
+		void add_aggregate(GlobAggregate *aggregate);
+		void add_watcher(const watcher_t *watcher){ watchers.push_back(watcher); }
+		void remove_watcher(const watcher_t *watcher);
 		
 		const std::string &name(){ return _name; }
+		const loglang::any &name_value() const { return _name_value; }
+		const std::vector<std::shared_ptr<Program>> &programs() const { return at_modify; }
 		void set(any str, Context &context);
+		/// Sets the value as loaded from a snapshot: aggregates are updated, but nothing runs.
+		void restore(any value);
 		const loglang::any &get() const;
 	};
 }
@@ -48,6 +48,8 @@ Token Tokenizer::real_next()
 		return Token(*pos++,Token::VAR);
 	else if (std::isdigit(*pos))
 		type=Token::NUMBER;
+	else if (*pos=='$')
+		type=Token::CAPTURE;
 	else if (*pos=='(') // For unichar tokens, return.
 		return Token(*pos++, Token::OPEN_PAREN);
 	else if (*pos==',') 
@@ -84,6 +86,12 @@ Token Tokenizer::real_next()
 		str=std::string(start+1, pos);
 		++pos;
 	}
+	else if (type==Token::CAPTURE){
+		while (std::isdigit(*pos) && pos<data_end) ++pos;
+		str=std::string(start+1, pos);
+		if (str.empty())
+			throw unexpected_char(position_to_string(), '$');
+	}
 	else if (type==Token::NUMBER){
 		while (std::find(std::begin(number), std::end(number), *pos)!=std::end(number) && pos<data_end) ++pos;
 		str=std::string(start, pos);
@@ -50,6 +50,7 @@ namespace loglang{
 			OPEN_CURLY=14,
 			CLOSE_CURLY=15,
 			COLON=16,
+			CAPTURE=17, // $1, group of the regex rule match
 			
 			INVALID=255
 		};
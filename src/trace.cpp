@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ostream>
+#include <iomanip>
+#include <unistd.h>
+
+#include "trace.hpp"
+#include "symbol.hpp"
+#include "utils.hpp"
+
+using namespace loglang;
+
+void Tracer::write_json(std::ostream &out) const
+{
+	size_t count=std::min<uint64_t>(total, ring.size());
+	size_t first=(total>ring.size()) ? next : 0; // Oldest
+	auto per_us=ticks_per_ns()*1000;
+	auto pid=getpid();
+
+	out<<std::fixed<<std::setprecision(3);
+	out<<"{\"displayTimeUnit\": \"ns\", \"otherData\": {\"spans\": "<<total<<", \"kept\": "<<count<<"}, \"traceEvents\": [";
+	for(size_t i=0;i<count;i++){
+		auto &s=ring[(first+i)%ring.size()];
+		out<<(i ? ",\n" : "\n");
+		out<<"{\"ph\": \"X\", \"pid\": "<<pid<<", \"tid\": 1, \"ts\": "<<s.start/per_us<<", \"dur\": "<<(s.end-s.start)/per_us;
+		switch(s.kind){
+			case LINE:
+				out<<", \"cat\": \"line\", \"name\": "<<json_quote(s.symbol ? s.symbol->name() : std::string("line"));
+				break;
+			case CASCADE:
+				out<<", \"cat\": \"cascade\", \"name\": \"cascade\"";
+				break;
+			case PROGRAM:
+				out<<", \"cat\": \"program\", \"name\": "<<json_quote(s.name ? *s.name : std::string("?"));
+				break;
+		}
+		out<<", \"args\": {";
+		if (s.kind==PROGRAM){
+			out<<"\"trigger\": "<<(s.symbol ? json_quote(s.symbol->name()) : std::string("null"))<<", \"nwrites\": "<<s.nwrites<<", \"writes\": [";
+			for(uint32_t w=0;w<s.nwrites && w<max_writes;w++)
+				out<<(w ? ", " : "")<<json_quote(s.writes[w]->name());
+			out<<"]";
+		}
+		out<<"}}";
+	}
+	out<<"\n]}"<<std::endl;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <iosfwd>
+#include <cstdint>
+
+#include "stats.hpp"
+
+namespace loglang{
+	class Symbol;
+
+	/**
+	 * @short Spans of the rule cascades, for Chrome trace-event JSON.
+	 *
+	 * Each input line is a span, with the cascade of the rules it runs inside, and a span per
+	 * program inside that, with its trigger and the symbols it changed. The scheduler runs the
+	 * cascade by rank and not recursively, so programs are siblings; the trigger tells which
+	 * change ran each. Spans are kept in a ring of the last ones, and written on demand.
+	 *
+	 * Only the tick count and pointers are stored per span; names are converted when written.
+	 */
+	class Tracer{
+	public:
+		enum kind_t : uint8_t{ LINE, CASCADE, PROGRAM };
+		static const int max_writes=4; // Kept per span; the count is of all
+		class Span{
+		public:
+			uint64_t start;
+			uint64_t end;
+			const std::string *name; // Of the program, interned
+			Symbol *symbol; // Line key, or program trigger
+			uint32_t nwrites;
+			Symbol *writes[max_writes];
+			kind_t kind;
+		};
+	private:
+		std::vector<Span> ring;
+		size_t next=0; // Where the next span goes
+		uint64_t total=0;
+		std::unordered_set<std::string> names;
+		Span open; // Running program
+		bool is_open=false;
+	public:
+		Tracer(size_t capacity) : ring(std::max<size_t>(1, capacity)){}
+
+		/// A stable pointer to the name, for spans. Programs keep it.
+		const std::string *intern(const std::string &name){ return &*names.insert(name).first; }
+
+		void add(kind_t kind, uint64_t start, uint64_t end, Symbol *symbol){
+			ring[next]=Span{start, end, nullptr, symbol, 0, {}, kind};
+			push();
+		}
+		void begin_program(const std::string *name, Symbol *trigger, uint64_t start){
+			open=Span{start, 0, name, trigger, 0, {}, PROGRAM};
+			is_open=true;
+		}
+		/// A symbol changed; kept if some program is running.
+		void write(Symbol *symbol){
+			if (!is_open)
+				return;
+			if (open.nwrites<max_writes)
+				open.writes[open.nwrites]=symbol;
+			open.nwrites++;
+		}
+		void end_program(uint64_t end){
+			if (!is_open)
+				return;
+			open.end=end;
+			ring[next]=open;
+			is_open=false;
+			push();
+		}
+
+		/// Writes the kept spans as Chrome trace-event JSON, that Perfetto and chrome://tracing open.
+		void write_json(std::ostream &out) const;
+		uint64_t spans() const { return total; }
+	private:
+		void push(){
+			next=(next+1)%ring.size();
+			total++;
+		}
+	};
+}
@@ -19,11 +19,22 @@
 
 #include <execinfo.h>
 #include <iostream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "utils.hpp"
 #include "cxxabi.h"
 
 namespace loglang {
+	// Command line options, set at main.
+	bool debug=false;
+	bool check_vm=false;
+	bool units=false;
+
 	/// Inspiration from http://www.gnu.org/software/libc/manual/html_node/Backtraces.html
 	void print_backtrace()
 	{
@@ -81,5 +92,48 @@ namespace loglang {
 		}
 		trim(data);
 	}
+	
+	std::string json_quote(std::string_view text){
+		static const char hex[]="0123456789abcdef";
+		std::string ret="\"";
+		for(char c: text){
+			if (c=='"' || c=='\\'){
+				ret+='\\';
+				ret+=c;
+			}
+			else if ((unsigned char)c<0x20){
+				ret+="\\u00";
+				ret+=hex[(c>>4)&0xf];
+				ret+=hex[c&0xf];
+			}
+			else
+				ret+=c;
+		}
+		ret+='"';
+		return ret;
+	}
+	
+	void write_file_synced(const std::string &filename, std::string_view data){
+		auto tmpname=filename+".tmp";
+		int fd=open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd<0)
+			throw std::runtime_error(tmpname+": "+strerror(errno));
+		size_t done=0;
+		while (done<data.length()){
+			auto n=write(fd, data.data()+done, data.length()-done);
+			if (n<0 && errno==EINTR)
+				continue;
+			if (n<0){
+				auto err=errno;
+				close(fd);
+				throw std::runtime_error(tmpname+": "+strerror(err));
+			}
+			done+=n;
+		}
+		if (fsync(fd)<0 || close(fd)<0)
+			throw std::runtime_error(tmpname+": "+strerror(errno));
+		if (rename(tmpname.c_str(), filename.c_str())<0)
+			throw std::runtime_error(filename+": "+strerror(errno));
+	}
 }
 
@@ -18,6 +18,7 @@
 
 #include <set>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <memory>
 
@@ -70,5 +71,9 @@ namespace loglang{
 	double to_number(const std::string &str);
 	void trim(std::string &);
 	void clean(std::string &);
+	/// The text as a JSON string, with the quotes.
+	std::string json_quote(std::string_view text);
+	/// Writes the data to a temporary file, syncs it and renames it to filename, so it is replaced at once. Throws on error.
+	void write_file_synced(const std::string &filename, std::string_view data);
 };
 
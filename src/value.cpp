@@ -4,9 +4,9 @@
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  *     http://www.apache.org/licenses/LICENSE-2.0
- * 
+ *
  * Unless required by applicable law or agreed to in writing, software
  * distributed under the License is distributed on an "AS IS" BASIS,
  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
@@ -19,94 +19,62 @@
 
 #include "value.hpp"
 #include "utils.hpp"
-#include "cxxabi.h"
 
+using namespace loglang;
 
+void any::release()
+{
+	if (_type==STRING){
+		if (s->refs.fetch_sub(1, std::memory_order_acq_rel)==1)
+			delete s;
+	}
+	else if (_type==LIST){
+		if (l->refs.fetch_sub(1, std::memory_order_acq_rel)==1)
+			delete l;
+	}
+}
 
-/// Implementation of types.
+const char *any::type_name() const
+{
+	switch(_type){
+		case NONE:
+			return "none";
+		case INT:
+			return "int";
+		case DOUBLE:
+			return "double";
+		case BOOL:
+			return "bool";
+		case STRING:
+			return "string";
+		case LIST:
+			return "list";
+	}
+	return "unknown";
+}
 
-namespace loglang{
-	class string : public value_base{
-		std::string str;
-	public:
-		string(std::string str) : value_base("string"), str(std::move(str)) {}
-		const std::string &to_string() const override{
-			return str;
-		}
-		std::unique_ptr< value_base > clone() const override{
-			return to_any(str);
-		}
-		int cmp(const any &o) const{
-			return str.compare( o->to_string() );
-		}
-	};
-	class _double : public value_base{
-		double val;
-	public:
-		_double(double d) : value_base("double"), val(d) {}
-		virtual double to_double() const override{
-			return val;
-		}
-		std::unique_ptr< value_base > clone() const override{
-			return to_any(val);
-		}
-		int cmp(const any &o) const{
-			auto r=val - o->to_double();
+int any::cmp(const any &o) const
+{
+	switch(_type){
+		case STRING:
+			return s->val.compare( o.to_string() );
+		case DOUBLE:{
+			auto r=d - o.to_double();
 // 			std::cerr<<"cmp d"<<val<<" >< "<<o->to_double()<<" = "<<r<<std::endl;
 			return (r<0) ? -1 : (r>0) ? 1 : 0;
 		}
-	};
-	class _int : public value_base{
-		int64_t val;
-	public:
-		_int(int64_t d) : value_base("int"), val(d) {}
-		virtual int64_t to_int() const override{
-			return val;
-		}
-		virtual double to_double() const override{
-			return val;
-		}
-		std::unique_ptr< value_base > clone() const override{
-			return to_any(val);
-		}
-		
-		int cmp(const any &o) const{
-			return val - o->to_int();
-		}
-	};
-	class _bool : public value_base{
-		bool val;
-	public:
-		_bool(bool d) : value_base("bool"), val(d) {}
-		std::unique_ptr< value_base > clone() const override{
-			return to_any(val);
-		}
-		virtual bool to_bool() const override{
-			return val;
+		case INT:{
+			auto oi=o.to_int();
+			return (i<oi) ? -1 : (i>oi) ? 1 : 0;
 		}
-		int cmp(const any &o) const{
-			return val!=o->to_bool();
-		}
-	};
-	class _list : public value_base{
-		std::vector<any> val;
-	public:
-		_list(std::vector<any> d) : value_base("list"), val(std::move(d)) {}
-		std::unique_ptr< value_base > clone() const override{
-			std::vector<any> copy;
-			for(auto &a: val)
-				copy.push_back(a->clone());
-			return to_any(std::move(copy));
-		}
-		virtual const std::vector<any> &to_list() const override{
-			return val;
-		}
-		int cmp(const any &o) const{
-			const _list *po=dynamic_cast<const _list *>(o.get());
+		case BOOL:
+			return b!=o.to_bool();
+		case LIST:{
+			auto &val=l->val, &oval=o.to_list();
 			auto I=std::begin(val), endI=std::end(val);
-			auto J=std::begin(po->val), endJ=std::end(po->val);
+			auto J=std::begin(oval), endJ=std::end(oval);
 			while (I!=endI && J!=endJ){
-				auto res=(*I)->cmp(*J);
+				auto res=I->cmp(*J);
 				if (res!=0)
 					return res;
 				++I; ++J;
@@ -119,46 +87,29 @@ namespace loglang{
 				return 1;
 			return -100; // Should never get here.
 		}
-	};
+		case NONE:
+			break;
+	}
+	throw invalid_conversion(type_name(), o);
 }
 
 // Other functions.
 namespace std{
-	std::string to_string(const loglang::value_base *any);
-
-	std::string to_string(const loglang::any &any)
-	{
-		return to_string(static_cast<const loglang::value_base *>(any.get()));
-	}
-
-	std::string to_string(const loglang::value_base *any){
-		{
-			auto val=dynamic_cast<const loglang::string*>(any);
-			if (val)
-				return std::string("\"")+val->to_string()+std::string("\"");
-		}
-		{
-			auto val=dynamic_cast<const loglang::_int*>(any);
-			if (val)
-				return std::to_string(val->to_int());
-		}
-		{
-			auto val=dynamic_cast<const loglang::_double*>(any);
-			if (val)
-				return std::to_string(val->to_double());
-		}
-		{
-			auto val=dynamic_cast<const loglang::_bool*>(any);
-			if (val)
-				return val->to_bool() ? "true" : "false";
-		}
-		{
-			auto val=dynamic_cast<const loglang::_list*>(any);
-			if (val){
+	std::string to_string(const loglang::any &any){
+		switch(any.type()){
+			case loglang::any::STRING:
+				return std::string("\"")+any.to_string()+std::string("\"");
+			case loglang::any::INT:
+				return std::to_string(any.to_int());
+			case loglang::any::DOUBLE:
+				return std::to_string(any.to_double());
+			case loglang::any::BOOL:
+				return any.to_bool() ? "true" : "false";
+			case loglang::any::LIST:{
 				std::stringstream ret;
 				ret<<"[";
 				bool first=true;
-				for(auto &v: val->to_list()){
+				for(auto &v: any.to_list()){
 					if (!first){
 						ret<<", ";
 					}
@@ -169,50 +120,9 @@ namespace std{
 				ret<<"]";
 				return ret.str();
 			}
+			case loglang::any::NONE:
+				break;
 		}
-		
-		std::string tpename=typeid(*any).name();
-		int st;
-		char *demangled=abi::__cxa_demangle(tpename.c_str(), 0, 0, &st);
-		if (demangled){
-			tpename=demangled;
-			free(demangled);
-		}
-
-		return std::string("[[")+tpename+"]]";
+		return "[[none]]";
 	}
 }
-
-using namespace loglang;
-
-any loglang::to_any(std::string str){
-	return std::make_unique<string>(std::move(str));
-}
-
-any loglang::to_any(double val){
-	return std::make_unique<_double>(val);
-}
-
-any loglang::to_any(int64_t val){
-	return std::make_unique<_int>(val);
-}
-
-any loglang::to_any(bool val){
-	return std::make_unique<_bool>(val);
-}
-any loglang::to_any(std::vector<any> val){
-	return std::make_unique<_list>(std::move(val));
-}
-
-
-namespace loglang{
-	bool operator==(const any &a, const any &b){
-		if (!a || !b) // null elements always false.
-			return false;
-		
-		if (typeid(*a)!=typeid(*b))
-			return false;
-// 		std::cerr<<"Cmp"<<std::endl;
-		return a->cmp(b) == 0;
-	}
-};
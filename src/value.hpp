@@ -4,9 +4,9 @@
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  *     http://www.apache.org/licenses/LICENSE-2.0
- * 
+ *
  * Unless required by applicable law or agreed to in writing, software
  * distributed under the License is distributed on an "AS IS" BASIS,
  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
@@ -19,25 +19,54 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <cstdint>
 
 
 namespace loglang{
-	class value_base;
-	using any = std::unique_ptr<value_base>;
+	class any;
 }
 
 namespace std{
 	std::string to_string(const loglang::any &any);
-	std::string to_string(const loglang::value_base *any);
 }
 
 namespace loglang{
-	class value_base{
+	/**
+	 * @short Immutable payload shared by all the copies of a string or list value.
+	 */
+	template<typename T>
+	class shared_payload{
+	public:
+		std::atomic<int> refs;
+		const T val;
+
+		shared_payload(T val) : refs(1), val(std::move(val)) {}
+	};
+
+	/**
+	 * @short A loglang value.
+	 *
+	 * Small tagged union, 16 bytes. Numbers and bools are stored inline, so creating, copying and
+	 * comparing them never allocates. Strings and lists point to an immutable payload that is
+	 * shared between copies and freed with the last one.
+	 *
+	 * Default constructed values are null, which means undefined.
+	 */
+	class any{
 	public:
+		enum type_t : uint8_t{
+			NONE=0,
+			INT,
+			DOUBLE,
+			BOOL,
+			STRING,
+			LIST
+		};
 		class invalid_conversion : public std::exception {
 			std::string str;
 		public:
-			invalid_conversion(std::string _str, const value_base *v){
+			invalid_conversion(std::string _str, const any &v){
 				str="Invalid conversion to ";
 				str+=_str;
 				str+=" from ";
@@ -47,43 +76,103 @@ namespace loglang{
 				return str.c_str();
 			}
 		};
+	private:
+		using string_payload=shared_payload<std::string>;
+		using list_payload=shared_payload<std::vector<any>>;
+		union{
+			int64_t i;
+			double d;
+			bool b;
+			string_payload *s;
+			list_payload *l;
+		};
+		type_t _type;
+
+		bool is_shared() const { return _type==STRING || _type==LIST; }
+		void acquire(){
+			if (_type==STRING)
+				s->refs.fetch_add(1, std::memory_order_relaxed);
+			else if (_type==LIST)
+				l->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+		void release();
 	public:
-		const std::string type_name;
-		
-		value_base(std::string _type_name) : type_name(std::move(_type_name)) {} 
-		virtual ~value_base(){}
-		
-		virtual any clone() const = 0;
-		virtual int cmp(const any &) const = 0;
-		
-		virtual int64_t to_int() const{
-			throw invalid_conversion("int", this);
+		any() : i(0), _type(NONE) {}
+		explicit any(int64_t v) : i(v), _type(INT) {}
+		explicit any(double v) : d(v), _type(DOUBLE) {}
+		explicit any(bool v) : i(0), _type(BOOL) { b=v; }
+		explicit any(std::string v) : s(new string_payload(std::move(v))), _type(STRING) {}
+		explicit any(std::vector<any> v) : l(new list_payload(std::move(v))), _type(LIST) {}
+
+		any(const any &o) : i(o.i), _type(o._type) { acquire(); }
+		any(any &&o) : i(o.i), _type(o._type) { o._type=NONE; }
+		~any(){ if (is_shared()) release(); }
+		any &operator=(const any &o){
+			any tmp(o);
+			std::swap(i, tmp.i);
+			std::swap(_type, tmp._type);
+			return *this;
 		}
-		virtual double to_double() const{
-			throw invalid_conversion("double", this);
+		any &operator=(any &&o){
+			if (this!=&o){
+				if (is_shared())
+					release();
+				i=o.i;
+				_type=o._type;
+				o._type=NONE;
+			}
+			return *this;
 		}
-		virtual const std::string &to_string() const{
-			throw invalid_conversion("string", this);
+
+		type_t type() const { return _type; }
+		const char *type_name() const;
+		explicit operator bool() const { return _type!=NONE; }
+		void reset(){ if (is_shared()) release(); _type=NONE; }
+
+		int cmp(const any &o) const;
+
+		int64_t to_int() const{
+			if (_type!=INT)
+				throw invalid_conversion("int", *this);
+			return i;
 		}
-		virtual bool to_bool() const{
-			throw invalid_conversion("bool", this);
+		double to_double() const{
+			if (_type==DOUBLE)
+				return d;
+			if (_type==INT)
+				return i;
+			throw invalid_conversion("double", *this);
 		}
-		virtual const std::vector<any> &to_list() const{
-			throw invalid_conversion("list", this);
+		const std::string &to_string() const{
+			if (_type!=STRING)
+				throw invalid_conversion("string", *this);
+			return s->val;
+		}
+		bool to_bool() const{
+			if (_type!=BOOL)
+				throw invalid_conversion("bool", *this);
+			return b;
+		}
+		const std::vector<any> &to_list() const{
+			if (_type!=LIST)
+				throw invalid_conversion("list", *this);
+			return l->val;
 		}
 	};
-	class string;
-	class _int;
-	class _double;
-	class _bool;
-	class _list;
-	
-	
-	any to_any(std::string str);
-	any to_any(double val);
-	any to_any(int64_t val);
-	any to_any(bool val);
-	any to_any(std::vector<any> vec);
-	
-	bool operator==(const any &, const any &);
+	static_assert(sizeof(any)==16, "loglang::any should be 16 bytes");
+
+	inline any to_any(std::string str){ return any(std::move(str)); }
+	inline any to_any(double val){ return any(val); }
+	inline any to_any(int64_t val){ return any(val); }
+	inline any to_any(bool val){ return any(val); }
+	inline any to_any(std::vector<any> vec){ return any(std::move(vec)); }
+
+	/// Same type and value. Null values are never equal.
+	inline bool operator==(const any &a, const any &b){
+		if (!a || !b) // null elements always false.
+			return false;
+		if (a.type()!=b.type())
+			return false;
+		return a.cmp(b) == 0;
+	}
 };
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdexcept>
+
+#include "vm.hpp"
+#include "bytecode.hpp"
+#include "context.hpp"
+#include "aggregate.hpp"
+
+using namespace loglang;
+
+Bindings::Bindings(const Bytecode &bc, Context &context)
+{
+	for(auto &name: bc.symbols)
+		symbols.push_back(&context.get_value(name));
+	for(auto &glob: bc.globs)
+		globs.emplace_back(glob);
+	for(auto &name: bc.functions)
+		functions.push_back(context.get_function(name));
+	for(auto &glob: bc.aggregates)
+		aggregates.push_back(&context.get_aggregate(glob));
+	for(auto &in: bc.code){
+		if (in.op==Instr::AGG && (in.b==GlobAggregate::MIN || in.b==GlobAggregate::MAX))
+			aggregates[in.a]->keep_sorted();
+	}
+}
+
+namespace{
+	/// Keeps the VM stack at its size at entry, even on exceptions.
+	class stack_frame{
+		std::vector<any> &stack;
+		size_t base;
+	public:
+		stack_frame(std::vector<any> &stack, size_t size) : stack(stack), base(stack.size()){
+			stack.resize(base+size);
+		}
+		~stack_frame(){
+			stack.resize(base);
+		}
+		size_t offset() const { return base; }
+	};
+
+	const any *dry_run_load(const store_log &log, const std::string &name){
+		for(auto I=log.rbegin(), endI=log.rend(); I!=endI; ++I)
+			if (I->first==name)
+				return &I->second;
+		return nullptr;
+	}
+}
+
+any VM::run(const Bytecode &bc, const Bindings &bindings, std::vector<any> &state, Context &context, store_log *dry_run)
+{
+	stack_frame frame(stack, bc.nregisters);
+	auto base=frame.offset();
+#define R(n) stack[base+(n)]
+
+	const Instr *code=bc.code.data();
+	size_t pc=0, end=bc.code.size();
+	while (pc<end){
+		const Instr &in=code[pc++];
+		switch(in.op){
+			case Instr::NOP:
+				break;
+			case Instr::NIL:
+				R(in.dst).reset();
+				break;
+			case Instr::CONST:
+				R(in.dst)=bc.constants[in.a];
+				break;
+			case Instr::LOAD:{
+				const any *v=dry_run ? dry_run_load(*dry_run, bc.symbols[in.a]) : nullptr;
+				if (!v)
+					v=&bindings.symbols[in.a]->get();
+				if (!*v)
+					throw std::runtime_error(std::string("Value <")+bc.symbols[in.a]+"> undefined. Cant use yet.");
+				R(in.dst)=*v;
+			}
+			break;
+			case Instr::GLOB:
+				R(in.dst)=context.get_glob_values(bindings.globs[in.a]);
+				break;
+			case Instr::STORE:
+				if (dry_run)
+					dry_run->emplace_back(bc.symbols[in.a], R(in.b));
+				else
+					bindings.symbols[in.a]->set(R(in.b), context);
+				break;
+			case Instr::ADD:{
+				auto &r1=R(in.a), &r2=R(in.b);
+				if (r1.type()==any::INT && r2.type()==any::INT)
+					R(in.dst)=to_any( r1.to_int() + r2.to_int() );
+				else if (r1.type()==any::STRING && r2.type()==any::STRING)
+					R(in.dst)=to_any( r1.to_string() + r2.to_string() );
+				else
+					R(in.dst)=to_any( r1.to_double() + r2.to_double() );
+			}
+			break;
+			case Instr::SUB:{
+				auto &r1=R(in.a), &r2=R(in.b);
+				if (r1.type()==any::INT && r2.type()==any::INT)
+					R(in.dst)=to_any( r1.to_int() - r2.to_int() );
+				else
+					R(in.dst)=to_any( r1.to_double() - r2.to_double() );
+			}
+			break;
+			case Instr::MUL:{
+				auto &r1=R(in.a), &r2=R(in.b);
+				if (r1.type()==any::INT && r2.type()==any::INT)
+					R(in.dst)=to_any( r1.to_int() * r2.to_int() );
+				else
+					R(in.dst)=to_any( r1.to_double() * r2.to_double() );
+			}
+			break;
+			case Instr::DIV:
+				R(in.dst)=to_any( R(in.a).to_double() / R(in.b).to_double() );
+				break;
+			case Instr::LT:
+				R(in.dst)=to_any( R(in.a).to_double() < R(in.b).to_double() );
+				break;
+			case Instr::LTE:
+				R(in.dst)=to_any( R(in.a).to_double() <= R(in.b).to_double() );
+				break;
+			case Instr::GT:
+				R(in.dst)=to_any( R(in.a).to_double() > R(in.b).to_double() );
+				break;
+			case Instr::GTE:
+				R(in.dst)=to_any( R(in.a).to_double() >= R(in.b).to_double() );
+				break;
+			case Instr::EQ:
+				R(in.dst)=to_any( R(in.a).to_double() == R(in.b).to_double() );
+				break;
+			case Instr::NEQ:
+				R(in.dst)=to_any( R(in.a).to_double() != R(in.b).to_double() );
+				break;
+			case Instr::AND:
+				R(in.dst)=to_any( R(in.a).to_bool() && R(in.b).to_bool() );
+				break;
+			case Instr::OR:
+				R(in.dst)=to_any( R(in.a).to_bool() || R(in.b).to_bool() );
+				break;
+			case Instr::CALL:{
+				std::vector<any> args;
+				args.reserve(in.b);
+				for(uint16_t i=0;i<in.b;i++)
+					args.push_back(std::move(R(in.dst+i)));
+				auto f=bindings.functions[in.a];
+				if (f)
+					R(in.dst)=(*f)(context, args);
+				else
+					R(in.dst)=context.fn(bc.functions[in.a], args);
+			}
+			break;
+			case Instr::JMP:
+				pc=in.a;
+				break;
+			case Instr::JF:
+				if (!R(in.b).to_bool())
+					pc=in.a;
+				break;
+			case Instr::EDGE:{
+				bool current=R(in.b).to_bool();
+				bool prev=state[in.dst] ? state[in.dst].to_bool() : false;
+				if (current==prev)
+					pc=in.a;
+				else{
+					state[in.dst]=to_any(current);
+					state_writes++;
+				}
+			}
+			break;
+			case Instr::AT:
+				if (R(in.b)==state[in.dst])
+					pc=in.a;
+				else{
+					state[in.dst]=std::move(R(in.b));
+					state_writes++;
+				}
+				break;
+			case Instr::AGG:
+				R(in.dst)=bindings.aggregates[in.a]->get(GlobAggregate::kind_t(in.b));
+				break;
+			case Instr::CAPTURE:
+				R(in.dst)=context.capture(in.a);
+				break;
+			default:
+				throw std::runtime_error("Invalid opcode "+std::to_string(int(in.op)));
+		}
+	}
+	return std::move(R(bc.result));
+#undef R
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2015 David Moreno
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "value.hpp"
+#include "glob.hpp"
+
+namespace loglang{
+	class Context;
+	class Bytecode;
+	class Symbol;
+	class GlobAggregate;
+
+	/// List of (symbol, value) stores done by a program run, in order.
+	using store_log = std::vector<std::pair<std::string, any>>;
+	using function_t = std::function<any (Context &, const std::vector<any> &)>;
+
+	/**
+	 * @short Bytecode symbol and function tables resolved on a Context.
+	 *
+	 * Resolved once when the program is defined, so running it does not need to look up names.
+	 * Symbols are never removed from the context, so the pointers stay valid.
+	 */
+	class Bindings{
+	public:
+		std::vector<Symbol*> symbols;
+		std::vector<Glob> globs;
+		std::vector<const function_t*> functions; // nullptr if unknown at bind time.
+		std::vector<GlobAggregate*> aggregates; // Owned by the context, never removed.
+
+		Bindings() {}
+		Bindings(const Bytecode &bc, Context &context);
+	};
+
+	/**
+	 * @short Register based interpreter for Bytecode
+	 *
+	 * Registers of all nested runs live in a single stack, so a program that sets a symbol which
+	 * triggers another program does not need any new allocation for its registers.
+	 */
+	class VM{
+		std::vector<any> stack;
+	public:
+		uint64_t state_writes=0; // Changes of at and edge_if state, so callers know a run changed it
+		
+		/**
+		 * @short Runs the bytecode, and returns the result register.
+		 *
+		 * If dry_run is given stores are not performed, but appended to it, and further loads of that
+		 * symbols in the same run read from there. Used to check the VM against the AST.
+		 */
+		any run(const Bytecode &bc, const Bindings &bindings, std::vector<any> &state, Context &context, store_log *dry_run=nullptr);
+	};
+}